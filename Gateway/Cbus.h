@@ -0,0 +1,503 @@
+/** CBUS event layer.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Produces CBUS ACON/ACOF events for SignalBox Input and Output changes, and consumes learned events.
+ *
+ *  Produced events use the gateway's node number (CBUS_NODE_NUMBER) and event numbers:
+ *      0x0000 + (node << 4) + pin      Input node (0-15), pin (0-15).
+ *      0x0100 + (node << 3) + pin      Output node (0-31), pin (0-7).
+ *  With wide node numbers (NODES_WIDE) there are Input nodes 0-23 and Output nodes 0-63, and the Output events start at 0x0200.
+ *  ACON when the pin goes Hi, ACOF when it goes Lo.
+ *
+ *  Consumed events are looked up in a table of learned events. Each holds two event variables:
+ *      EV1     The SignalBox command to queue for the controller (COMMS_CMD_SET_HI or COMMS_CMD_INP_HI) | pin.
+ *      EV2     The node.
+ *  An ACON queues the Hi command, an ACOF its Lo counterpart (COMMS_CMD_SET_LO or COMMS_CMD_INP_LO).
+ *  Events are taught with the usual CBUS opcodes: NNLRN, EVLRN, EVULN and NNULN, addressed to CBUS_NODE_NUMBER.
+ *
+ *  Frames go through a CanTransport:
+ *      LoopbackCan     In-process stand-in for the CAN controller. Sent frames are received back.
+ *      Mcp2515Can      An MCP2515 CAN controller (if CBUS_MCP2515), using the ACAN2515 library.
+ *  Apart from Mcp2515Can, this needs only the CBUS definitions in Gateway.h, the COMMS_* commands in I2cComms.h
+ *  and highByte/lowByte. bin/host/cbusBench.cpp supplies those on Linux and benchmarks the event layer over LoopbackCan.
+ */
+
+#ifndef Cbus_h
+#define Cbus_h
+
+
+#if CBUS_MCP2515
+#include <SPI.h>
+#include <ACAN2515.h>
+#endif
+
+
+// CBUS opcodes.
+const uint8_t CBUS_OPC_NNLRN        = 0x53;     // Enter learn mode.
+const uint8_t CBUS_OPC_NNULN        = 0x54;     // Exit learn mode.
+const uint8_t CBUS_OPC_ACON         = 0x90;     // Accessory on.
+const uint8_t CBUS_OPC_ACOF         = 0x91;     // Accessory off.
+const uint8_t CBUS_OPC_EVULN        = 0x95;     // Unlearn an event.
+const uint8_t CBUS_OPC_EVLRN        = 0xD2;     // Learn an event variable.
+
+const uint8_t  CBUS_EVENT_LEN       =    5;     // Opcode, node number and event number.
+const uint16_t CBUS_EVENT_INPUT     = 0x000;    // Event number base for Inputs.
+const uint16_t CBUS_EVENT_OUTPUT    = NODES_WIDE ? 0x200 : 0x100;   // Event number base for Outputs (after the Inputs').
+const uint16_t CBUS_PRIORITY        = 0x580;    // Normal (0b1011) priority bits of a CAN ID.
+const uint8_t  CBUS_EVENT_NONE      = 0xff;     // Unused entry in the learned event table.
+
+
+/** A CAN frame.
+ */
+struct CanFrame
+{
+    uint16_t id;                                // Standard (11-bit) CAN ID.
+    uint8_t  len;                               // Data length (0-8).
+    uint8_t  data[8];                           // Data.
+};
+
+
+/** A learned event.
+ */
+struct CbusEvent
+{
+    uint16_t nodeNumber;                        // Producer's node number.
+    uint16_t eventNumber;                       // Event number.
+    uint8_t  ev1;                               // SignalBox command and pin, or CBUS_EVENT_NONE if unused.
+    uint8_t  ev2;                               // SignalBox node.
+};
+
+
+/** Abstract CAN transport.
+ */
+class CanTransport
+{
+    public:
+
+    virtual bool begin() = 0;
+    virtual bool canSend() = 0;                 // Room to send a frame?
+    virtual bool send(const CanFrame& aFrame) = 0;
+    virtual bool receive(CanFrame& aFrame) = 0; // Return true if a frame was received.
+};
+
+
+/** In-process loopback, standing in for a CAN controller.
+ *  Frames sent are received back, in order.
+ */
+class LoopbackCan: public CanTransport
+{
+    private:
+
+    CanFrame frames[CBUS_LOOPBACK_FRAMES];      // Frames sent and not yet received, a ring buffer.
+    uint8_t  head  = 0;
+    uint8_t  count = 0;
+
+
+    public:
+
+    bool begin()
+    {
+        head  = 0;
+        count = 0;
+        return true;
+    }
+
+
+    bool canSend()
+    {
+        return count < CBUS_LOOPBACK_FRAMES;
+    }
+
+
+    bool send(const CanFrame& aFrame)
+    {
+        if (!canSend())
+        {
+            return false;
+        }
+
+        frames[(head + count++) % CBUS_LOOPBACK_FRAMES] = aFrame;
+        return true;
+    }
+
+
+    bool receive(CanFrame& aFrame)
+    {
+        if (count == 0)
+        {
+            return false;
+        }
+
+        aFrame = frames[head];
+        head   = (head + 1) % CBUS_LOOPBACK_FRAMES;
+        count -= 1;
+        return true;
+    }
+};
+
+
+#if CBUS_MCP2515
+ACAN2515 mcp2515(CBUS_PIN_CS, SPI, CBUS_PIN_INT);  // The driver, global so its interrupt handler can reach it.
+
+
+/** An MCP2515 CAN controller, using the ACAN2515 library.
+ */
+class Mcp2515Can: public CanTransport
+{
+    public:
+
+    bool begin()
+    {
+        ACAN2515Settings settings(CBUS_FREQ, CBUS_BIT_RATE);
+        settings.mRequestedMode = ACAN2515Settings::NormalMode;
+
+        SPI.begin();
+        return mcp2515.begin(settings, [] { mcp2515.isr(); }) == 0;
+    }
+
+
+    bool canSend()
+    {
+        return mcp2515.transmitBufferCount(0) < mcp2515.transmitBufferSize(0);
+    }
+
+
+    bool send(const CanFrame& aFrame)
+    {
+        CANMessage message;
+        message.id  = aFrame.id;
+        message.len = aFrame.len;
+        memcpy(message.data, aFrame.data, aFrame.len);
+
+        return mcp2515.tryToSend(message);
+    }
+
+
+    bool receive(CanFrame& aFrame)
+    {
+        CANMessage message;
+
+        if (   (!mcp2515.available())
+            || (!mcp2515.receive(message))
+            || (message.ext)
+            || (message.rtr))
+        {
+            return false;
+        }
+
+        aFrame.id  = message.id;
+        aFrame.len = message.len;
+        memcpy(aFrame.data, message.data, message.len);
+        return true;
+    }
+};
+#endif
+
+
+/** CBUS event producer and consumer.
+ */
+class Cbus
+{
+    private:
+
+    CanTransport& can;                          // Transport for the frames.
+    uint16_t      nodeNumber;                   // Our CBUS node number.
+    uint8_t       canId;                        // Our CAN ID (1-127).
+    bool          learning  = false;            // In learn mode (between NNLRN and NNULN).
+
+    uint16_t      queue[CBUS_QUEUE_MAX];        // Events to send: event number, with CBUS_QUEUE_ON if ACON.
+    uint8_t       queueHead  = 0;
+    uint8_t       queueCount = 0;
+
+    CbusEvent     events[CBUS_EVENTS_MAX];      // Learned events.
+    bool          eventsChanged = false;        // Learned events need saving.
+
+    void          (*consumer)(uint8_t aCommand, uint8_t aNode) = NULL;  // Handler for consumed events.
+
+    uint32_t      framesSent     = 0;           // Statistics.
+    uint32_t      framesReceived = 0;
+    uint32_t      eventsProduced = 0;
+    uint32_t      eventsMerged   = 0;
+    uint32_t      eventsConsumed = 0;
+
+
+    public:
+
+    /** A Cbus layer using the given transport.
+     */
+    Cbus(CanTransport& aCan, uint16_t aNodeNumber, uint8_t aCanId):
+         can(aCan),
+         nodeNumber(aNodeNumber),
+         canId(aCanId)
+    {
+        memset(events, CBUS_EVENT_NONE, sizeof(events));
+    }
+
+
+    /** Start the transport.
+     */
+    bool begin()
+    {
+        return can.begin();
+    }
+
+
+    /** Set the handler for consumed events.
+     */
+    void onConsume(void (*aHandler)(uint8_t aCommand, uint8_t aNode))
+    {
+        consumer = aHandler;
+    }
+
+
+    /** Gets the learned events table, to save or load it.
+     */
+    CbusEvent* getEvents()
+    {
+        return events;
+    }
+
+
+    /** Have the learned events changed (since last asked)?
+     */
+    bool isEventsChanged()
+    {
+        bool changed = eventsChanged;
+        eventsChanged = false;
+        return changed;
+    }
+
+
+    /** Produce an event for an Input or Output pin's new state.
+     *  If the event is already queued, just update its state.
+     *  Return false if the queue is full.
+     */
+    bool produce(bool aIsOutput, uint8_t aNode, uint8_t aPin, bool aState)
+    {
+        uint16_t event = aIsOutput ? (CBUS_EVENT_OUTPUT + (aNode << 3) + aPin)
+                                   : (CBUS_EVENT_INPUT  + (aNode << 4) + aPin);
+        uint16_t entry = event | (aState ? CBUS_QUEUE_ON : 0);
+
+        eventsProduced += 1;
+
+        for (uint8_t index = 0; index < queueCount; index++)
+        {
+            uint16_t& queued = queue[(queueHead + index) % CBUS_QUEUE_MAX];
+            if ((queued & ~CBUS_QUEUE_ON) == event)
+            {
+                queued        = entry;              // Still waiting, so only the latest state need be sent.
+                eventsMerged += 1;
+                return true;
+            }
+        }
+
+        if (queueCount >= CBUS_QUEUE_MAX)
+        {
+            return false;
+        }
+
+        queue[(queueHead + queueCount++) % CBUS_QUEUE_MAX] = entry;
+        return true;
+    }
+
+
+    /** Send queued events while the transport has room, then process received frames.
+     */
+    void update()
+    {
+        CanFrame frame;
+
+        while (   (queueCount > 0)
+               && (can.canSend()))
+        {
+            uint16_t entry = queue[queueHead];
+
+            frame.id      = CBUS_PRIORITY | canId;
+            frame.len     = CBUS_EVENT_LEN;
+            frame.data[0] = (entry & CBUS_QUEUE_ON) ? CBUS_OPC_ACON : CBUS_OPC_ACOF;
+            frame.data[1] = highByte(nodeNumber);
+            frame.data[2] = lowByte(nodeNumber);
+            frame.data[3] = highByte(entry & ~CBUS_QUEUE_ON);
+            frame.data[4] = lowByte(entry);
+
+            if (!can.send(frame))
+            {
+                break;
+            }
+
+            queueHead   = (queueHead + 1) % CBUS_QUEUE_MAX;
+            queueCount -= 1;
+            framesSent += 1;
+        }
+
+        while (can.receive(frame))
+        {
+            framesReceived += 1;
+            processFrame(frame);
+        }
+    }
+
+
+    /** Statistics.
+     */
+    uint32_t getFramesSent()     { return framesSent;     }
+    uint32_t getFramesReceived() { return framesReceived; }
+    uint32_t getEventsProduced() { return eventsProduced; }
+    uint32_t getEventsMerged()   { return eventsMerged;   }
+    uint32_t getEventsConsumed() { return eventsConsumed; }
+
+
+    private:
+
+    /** Process a received frame.
+     */
+    void processFrame(CanFrame& aFrame)
+    {
+        if (aFrame.len < 3)
+        {
+            return;
+        }
+
+        uint16_t nn = (aFrame.data[1] << 8) | aFrame.data[2];
+        uint16_t en = (aFrame.len >= 5) ? ((aFrame.data[3] << 8) | aFrame.data[4]) : 0;
+
+        switch (aFrame.data[0])
+        {
+            case CBUS_OPC_ACON:
+            case CBUS_OPC_ACOF:  if (aFrame.len >= CBUS_EVENT_LEN)
+                                 {
+                                     consume(nn, en, aFrame.data[0] == CBUS_OPC_ACON);
+                                 }
+                                 break;
+
+            case CBUS_OPC_NNLRN: learning = nn == nodeNumber;
+                                 break;
+
+            case CBUS_OPC_NNULN: if (nn == nodeNumber)
+                                 {
+                                     learning = false;
+                                 }
+                                 break;
+
+            case CBUS_OPC_EVLRN: // NN EN EV# EV value, NN and EN being the event's.
+                                 if (   (learning)
+                                     && (aFrame.len >= 7))
+                                 {
+                                     learn(nn, en, aFrame.data[5], aFrame.data[6]);
+                                 }
+                                 break;
+
+            case CBUS_OPC_EVULN: if (learning)
+                                 {
+                                     CbusEvent* event = findEvent(nn, en);
+                                     if (event != NULL)
+                                     {
+                                         event->ev1    = CBUS_EVENT_NONE;
+                                         eventsChanged = true;
+                                     }
+                                 }
+                                 break;
+
+            default:             break;
+        }
+    }
+
+
+    /** Consume an event, if it's been learned.
+     */
+    void consume(uint16_t aNodeNumber, uint16_t aEventNumber, bool aOn)
+    {
+        CbusEvent* event = findEvent(aNodeNumber, aEventNumber);
+
+        if (   (event != NULL)
+            && (consumer != NULL))
+        {
+            uint8_t command = event->ev1 & COMMS_COMMAND_MASK;
+
+            if (   (command == COMMS_CMD_SET_LO)
+                || (command == COMMS_CMD_SET_HI))
+            {
+                command = aOn ? COMMS_CMD_SET_HI : COMMS_CMD_SET_LO;
+            }
+            else if (   (command == COMMS_CMD_INP_LO)
+                     || (command == COMMS_CMD_INP_HI))
+            {
+                command = aOn ? COMMS_CMD_INP_HI : COMMS_CMD_INP_LO;
+            }
+            else
+            {
+                return;                             // Not something we can consume.
+            }
+
+            eventsConsumed += 1;
+            consumer(command | (event->ev1 & COMMS_OPTION_MASK), event->ev2);
+        }
+    }
+
+
+    /** Learn an event variable (1 or 2) of an event, adding the event if it's new.
+     */
+    void learn(uint16_t aNodeNumber, uint16_t aEventNumber, uint8_t aIndex, uint8_t aValue)
+    {
+        CbusEvent* event = findEvent(aNodeNumber, aEventNumber);
+
+        if (event == NULL)
+        {
+            event = findEvent(0, 0, true);
+            if (event == NULL)
+            {
+                return;                             // Table full.
+            }
+
+            event->nodeNumber  = aNodeNumber;
+            event->eventNumber = aEventNumber;
+            event->ev1         = COMMS_CMD_SET_HI;
+            event->ev2         = 0;
+        }
+
+        if (aIndex == 1)
+        {
+            event->ev1 = aValue;
+        }
+        else if (aIndex == 2)
+        {
+            event->ev2 = aValue;
+        }
+
+        eventsChanged = true;
+    }
+
+
+    /** Find a learned event, or a free entry.
+     *  Return NULL if not found.
+     */
+    CbusEvent* findEvent(uint16_t aNodeNumber, uint16_t aEventNumber, bool aFree = false)
+    {
+        for (uint8_t index = 0; index < CBUS_EVENTS_MAX; index++)
+        {
+            CbusEvent& event = events[index];
+
+            if (aFree ? (event.ev1 == CBUS_EVENT_NONE)
+                      : (   (event.ev1         != CBUS_EVENT_NONE)
+                         && (event.nodeNumber  == aNodeNumber)
+                         && (event.eventNumber == aEventNumber)))
+            {
+                return &event;
+            }
+        }
+
+        return NULL;
+    }
+};
+
+
+#endif
@@ -20,16 +20,38 @@
 // Include optional code
 #define SERIAL_CMRI     true    // Include serial CMRI processing.
 #define SERIAL_COMMAND  true    // Include serial command processing.
+#define SERIAL_FRAMED   false   // Carry CMRI, commands and import/export as framed channels on Serial. See SerialMux.h.
 #define EZYBUS_CONVERT  true    // Include code to detect and convert EzyBus installation.
 #define LCD_I2C         true    // Include code for LCD connected by I2C.
+#define COMMS_RS485     false   // Use an RS-485 bus (instead of I2C) for the Output modules and Gateway. See Transport.h.
+#define NODES_WIDE      false   // Wide node numbers: 64 Output nodes and 24 Input nodes. Set the same in all three sketches. See Build.md.
+
+// The RS-485 bus needs a UART of its own: Serial also carries debug output (and the controller's CMRI and commands).
+#if SB_OUTPUT_MODULE
+#define RS485_SOFTWARE  false   // OutputModule: Serial, every other pin is in use. Debug output must be compiled out (see isDebug above).
+#define RS485_SERIAL    Serial
+#else
+#define RS485_SOFTWARE  true    // Controller and Gateway: a SoftwareSerial on RS485_RX_PIN and RS485_TX_PIN.
+#define RS485_SERIAL    rs485Serial
+#endif
+
+#if COMMS_RS485 && !RS485_SOFTWARE && !defined(isDebug)
+#error "RS-485 on Serial: compile debug output out with #define isDebug(x) (false)"
+#endif
 
 
 // I2C node numbers.
 const uint8_t  I2C_CONTROLLER_ID       = 0x10;      // Controller ID.
 const uint8_t  I2C_GATEWAY_ID          = 0x00;      // Gateway ID. Set to zero to disable Gateway code.
+const uint8_t  GATEWAY_ATTENTION_PIN   = 0;         // Pin the Gateway holds low while it has requests. Zero for an I2C doorbell instead (see I2cComms.h).
 const uint8_t  I2C_INPUT_BASE_ID       = 0x20;      // Input nodes base ID.
 const uint8_t  I2C_OUTPUT_BASE_ID      = 0x50;      // Output nodes base ID.
 const uint8_t  I2C_MODULE_ID_JUMPERS   = 0xff;      // Use jumpers to decide module ID.
+const uint8_t  I2C_ENUM_ID             = 0x4f;      // Shared ID of OutputModules waiting to be given a node number. Set to zero to disable enumeration.
+const uint8_t  I2C_OUTPUT_ID_MASK      = (NODES_WIDE && !COMMS_RS485) ? 0x07 : 0xff;    // Node bits in an Output module's ID. On I2C wide nodes use their address within their multiplexer segment.
+
+const uint8_t  I2C_MUX_BASE_ID         = 0x70;      // TCA9548A multiplexer base ID.
+const uint8_t  I2C_MUX_MAX             = 0;         // Number of multiplexers fitted (0-8). Set to zero to disable multiplexer code.
 
 const uint8_t  I2C_LCD_LO              = 0x27;      // Range of IDs to scan for LCD I2C device.
 const uint8_t  I2C_LCD_HI              = 0x3F;
@@ -37,6 +59,21 @@ const uint8_t  I2C_LCD_HI              = 0x3F;
 const uint32_t I2C_TIMEOUT             = 25000L;    // Wire timeout in microseconds.
 const long     I2C_SPEED               = 0;         // Speed of I2C comms. Set to 0 for default (100k). Not very robust, see I2cComms.setId().
 
+const long     RS485_SPEED             = 38400L;    // Speed of the RS-485 bus. SoftwareSerial (see RS485_SOFTWARE) is only reliable this fast.
+#if SB_CONTROLLER
+const uint8_t  RS485_RX_PIN            = 2;         // Controller's receive pin (instead of the alternate up button).
+const uint8_t  RS485_TX_PIN            = 3;         // Controller's transmit pin (instead of the alternate right button).
+const uint8_t  RS485_DE_PIN            = 12;        // Pin driving the transceiver's DE and /RE pins (instead of the interlock buzzer).
+#elif SB_OUTPUT_MODULE
+const uint8_t  RS485_DE_PIN            = A4;        // Pin driving the transceiver's DE and /RE pins. SDA is free when the modules aren't on I2C.
+#else
+const uint8_t  RS485_RX_PIN            = 4;         // Gateway's receive pin.
+const uint8_t  RS485_TX_PIN            = 5;         // Gateway's transmit pin.
+const uint8_t  RS485_DE_PIN            = 6;         // Pin driving the transceiver's DE and /RE pins.
+#endif
+const uint32_t RS485_TIMEOUT           = 5000L;     // Time (microseconds) to wait for a node's reply.
+const uint16_t RS485_TURNAROUND        = 50;        // Time (microseconds) a node waits before replying, so the master can release the bus.
+
 // Attached LCD displays.
 const bool     LCD_SHIELD              = false;     // Assume LCD shield present (or not). If false, use LCD_SHIELD_DETECT_PIN.
 const uint8_t  LCD_SHIELD_DETECT_PIN   = 11;        // Use this pin (must be low) to detect presence of LCD shield. If zero, don't detect.
@@ -47,6 +84,7 @@ const uint8_t  LCD_SHIELD_POSSIBLE     = LCD_SHIELD || LCD_SHIELD_DETECT_PIN;
  
 // Serial IO speed.
 const long    SERIAL_SPEED             = 115200;    // Speed of the serial port.
+const unsigned long CMRI_BUDGET        = 2000L;     // Time (microseconds) each pass of loop() may spend parsing buffered CMRI bytes.
 
 
 // LCD shield pins.
@@ -61,7 +99,7 @@ const uint8_t LCD_D7                   =      7;
 // Interlocks
 const uint8_t INTERLOCK_WARNING_PIN    =     13;    // When interlocks prevent an operation, set this pin high. If zero, no warning is shown.
 const long    INTERLOCK_WARNING_TIME   =   2000;    // Duration (msecs) of interlock warning.
-const uint8_t INTERLOCK_BUZZER_PIN     =     12;    // Buzzer pin to sound interlock warning on (about 900+ bytes of extra code). Zero disables buzzer tones.
+const uint8_t INTERLOCK_BUZZER_PIN     = COMMS_RS485 ? 0 : 12;  // Buzzer pin to sound interlock warning on (about 900+ bytes of extra code). Zero disables buzzer tones.
 const int     INTERLOCK_BUZZER_FREQ1   =    196;    // Frequency of warning first tone.
 const int     INTERLOCK_BUZZER_FREQ2   =    131;    // Frequency of warning second tone.
 const long    INTERLOCK_BUZZER_TIME1   =    200;    // Duration (msecs) of interlock warning first tone.
@@ -86,7 +124,8 @@ const long    DELAY_MULTIPLIER         =   1000;    // Multiply OutputDef.delay
 // Steps (all in msecs)
 const long    STEP_HARDWARE_SCAN       =  10000;    // Scan for new hardware - zero means no scan.
 const long    STEP_INPUT_SCAN          =     50;    // Scan the input switches - zero means no scan.
-const long    STEP_GATEWAY             =    100;    // Scan the gateway.
+const long    STEP_GATEWAY             =    100;    // Gateway rings the doorbell again if its requests are still waiting (polled this often on RS-485).
+const long    STEP_GATEWAY_CHANGES     =     50;    // Send the gateway any Input and Output state changes.
 const long    STEP_HEARTBEAT           =    200;    // Refresh heartbeat indicator.
 const long    STEP_SERVO               =     25;    // Step Servos.
 const long    STEP_LED                 =      5;    // Step LEDs.
@@ -121,7 +160,11 @@ const int     ANALOG_PIN_CUTOFF        =  0x200;    // When using analog pin for
 
 // Controller alternate pins that can be used to controll the menus. First entry unused.
 // Unused, Select, Left, Down, Up, right.
+#if COMMS_RS485
+const uint8_t BUTTON_PINS[] = { 0xff, A1, A2, A3, 0xff, 0xff };     // D2 and D3 carry the RS-485 bus.
+#else
 const uint8_t BUTTON_PINS[] = { 0xff, A1, A2, A3, 2, 3 };
+#endif
 
 
 // The output module jumper pins. 0xff means don't use.
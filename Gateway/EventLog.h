@@ -0,0 +1,311 @@
+/** Black-box event log.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Records every Input, Output and system event the gateway sees, in a ring buffer in RAM.
+ *  When full, the oldest records are overwritten. With EVENT_LOG_SPILL, older records are
+ *  moved to a ring in EEPROM before that happens (a few milliseconds per record, from loop()).
+ *  When an error is logged, or preserve() is called, all the records in RAM are moved to EEPROM,
+ *  so a post-mortem survives the Gateway being reset (e.g. by opening its serial port).
+ *  Only the first error of a burst (since starting, erasing or the last preserve()) does so, and the
+ *  EEPROM ring's position is written once at the end, to spare the EEPROM.
+ *
+ *  Each record is:
+ *      Micros      micros() when the event happened (4 bytes).
+ *      Type        LOG_... below.
+ *      Node        The node, or other detail (see LOG_...).
+ *      Value       The node's new states, or other detail (2 bytes).
+ *
+ *  dump() writes the log to Serial as text, oldest first, for bin/sbLog to decode:
+ *      #log <Count> <Lost> <Micros>    Header: records following, records lost, and micros() now.
+ *      <Micros><Type><Node><Value>     One line per record, in hex (8, 2, 2 and 4 digits).
+ *      #end
+ */
+
+#ifndef EventLog_h
+#define EventLog_h
+
+
+const uint8_t LOG_START    = 0x00;              // Gateway started.
+const uint8_t LOG_OUTPUT   = 0x01;              // Output node's states changed. Value is the states.
+const uint8_t LOG_INPUT    = 0x02;              // Input node's states changed. Value is the states.
+const uint8_t LOG_REQUEST  = 0x03;              // Request queued for the controller. Value is the command.
+const uint8_t LOG_SNAPSHOT = 0x04;              // Snapshot started. Node is the version, Value its length.
+const uint8_t LOG_ERROR    = 0x05;              // Error reported. Node is the command, Value the option.
+
+
+/** A record in the log.
+ */
+struct LogRecord
+{
+    uint32_t micros;                            // When.
+    uint8_t  type;                              // What (LOG_...).
+    uint8_t  node;                              // Which node.
+    uint16_t value;                             // States etc.
+};
+
+
+/** EEPROM ring buffer's position, kept before the records.
+ */
+struct LogSpill
+{
+    uint16_t head;                              // Oldest record.
+    uint16_t count;                             // Records in the ring.
+};
+
+
+/** Black-box event log.
+ */
+class EventLog
+{
+    private:
+
+    LogRecord records[EVENT_LOG_MAX];           // Ring buffer of the latest records.
+    uint8_t   head  = 0;                        // Oldest record.
+    uint8_t   count = 0;                        // Number of records.
+    uint16_t  lost  = 0;                        // Records overwritten, or dropped while dumping.
+    bool      dumping = false;                  // Being dumped, don't overwrite.
+    volatile bool preserving = false;           // Move all the records in RAM to EEPROM.
+    bool      errorArmed = true;                // The next error preserves the log.
+    uint8_t   preserved  = 0;                   // Records moved so far by this preserve.
+    LogSpill  spill;                            // EEPROM ring buffer.
+
+
+    /** Get a spilled record's EEPROM offset.
+     */
+    int spillOffset(uint16_t aIndex)
+    {
+        return EEPROM_LOG + sizeof(LogSpill) + ((spill.head + aIndex) % EEPROM_LOG_MAX) * sizeof(LogRecord);
+    }
+
+
+    /** Move the oldest record to EEPROM.
+     *  Saves the ring's position too, unless told not to (the caller will save it).
+     */
+    void spillOldest(bool aSavePosition = true)
+    {
+        noInterrupts();
+        LogRecord record = records[head];
+        head   = (head + 1) % EVENT_LOG_MAX;
+        count -= 1;
+        interrupts();
+
+        if (spill.count >= EEPROM_LOG_MAX)
+        {
+            spill.head   = (spill.head + 1) % EEPROM_LOG_MAX;
+            spill.count -= 1;
+        }
+
+        EEPROM.put(spillOffset(spill.count), record);
+        spill.count += 1;
+
+        if (aSavePosition)
+        {
+            EEPROM.put(EEPROM_LOG, spill);
+        }
+    }
+
+
+    /** Print a number as a fixed number of hex digits.
+     */
+    void printHex(uint32_t aValue, uint8_t aDigits)
+    {
+        while (aDigits-- > 0)
+        {
+            Serial.print((aValue >> (aDigits * 4)) & 0xf, HEX);
+        }
+    }
+
+
+    /** Print a record.
+     */
+    void printRecord(LogRecord& aRecord)
+    {
+        printHex(aRecord.micros, 8);
+        printHex(aRecord.type,   2);
+        printHex(aRecord.node,   2);
+        printHex(aRecord.value,  4);
+        Serial.println();
+    }
+
+
+    public:
+
+    /** Load the EEPROM ring buffer's position.
+     */
+    void begin()
+    {
+        EEPROM.get(EEPROM_LOG, spill);
+
+        if (   (spill.head  >= EEPROM_LOG_MAX)
+            || (spill.count >  EEPROM_LOG_MAX))
+        {
+            spill.head  = 0;                    // Never used.
+            spill.count = 0;
+            EEPROM.put(EEPROM_LOG, spill);
+        }
+
+        add(LOG_START, 0, 0);
+    }
+
+
+    /** Add a record, overwriting the oldest if the log is full (or dropping the new one while dumping).
+     *  The first error of a burst preserves the log.
+     *  Safe to call from interrupt handlers.
+     */
+    void add(uint8_t aType, uint8_t aNode, uint16_t aValue)
+    {
+        uint8_t sreg = SREG;
+        noInterrupts();
+
+        if (   (aType == LOG_ERROR)
+            && (errorArmed))
+        {
+            preserving = true;
+            errorArmed = false;
+        }
+
+        if (count >= EVENT_LOG_MAX)
+        {
+            lost += 1;
+
+            if (dumping)
+            {
+                SREG = sreg;
+                return;
+            }
+
+            head   = (head + 1) % EVENT_LOG_MAX;
+            count -= 1;
+        }
+
+        LogRecord& record = records[(head + count++) % EVENT_LOG_MAX];
+        record.micros = micros();
+        record.type   = aType;
+        record.node   = aNode;
+        record.value  = aValue;
+
+        SREG = sreg;
+    }
+
+
+    /** Move all the records in RAM to EEPROM, a record at a time from update().
+     *  The next error will preserve the log again.
+     */
+    void preserve()
+    {
+        noInterrupts();
+        preserving = true;
+        errorArmed = true;
+        interrupts();
+    }
+
+
+    /** Move the oldest record to EEPROM if preserving the log, or if the RAM buffer is over half full.
+     *  A preserve moves at most a buffer's worth (records keep arriving), then saves the ring's position.
+     *  Call from loop(), EEPROM writes are slow.
+     */
+    void update()
+    {
+        if (dumping)
+        {
+            return;
+        }
+
+        if (preserving)
+        {
+            if (   (count > 0)
+                && (preserved < EVENT_LOG_MAX))
+            {
+                spillOldest(false);
+                preserved += 1;
+            }
+            else
+            {
+                EEPROM.put(EEPROM_LOG, spill);
+                preserved  = 0;
+                preserving = false;
+            }
+        }
+        else if (   (EVENT_LOG_SPILL)
+                 && (count > EVENT_LOG_MAX / 2))
+        {
+            spillOldest();
+        }
+    }
+
+
+    /** Write the log to Serial, oldest (spilled) records first.
+     */
+    void dump()
+    {
+        LogRecord record;
+
+        noInterrupts();
+        uint8_t  ramCount = count;
+        uint32_t now      = micros();
+        dumping = true;
+        interrupts();
+
+        Serial.print(F("#log "));
+        Serial.print(spill.count + ramCount);
+        Serial.print(' ');
+        Serial.print(lost);
+        Serial.print(' ');
+        Serial.print(now);
+        Serial.println();
+
+        for (uint16_t index = 0; index < spill.count; index++)
+        {
+            EEPROM.get(spillOffset(index), record);
+            printRecord(record);
+        }
+
+        // Records added while dumping are left for next time.
+        for (uint8_t index = 0; index < ramCount; index++)
+        {
+            noInterrupts();
+            record = records[(head + index) % EVENT_LOG_MAX];
+            interrupts();
+            printRecord(record);
+        }
+
+        Serial.println(F("#end"));
+        dumping = false;
+    }
+
+
+    /** Erase the log.
+     */
+    void erase()
+    {
+        noInterrupts();
+        head  = 0;
+        count = 0;
+        lost  = 0;
+        preserving = false;
+        errorArmed = true;
+        interrupts();
+        preserved = 0;
+
+        spill.head  = 0;
+        spill.count = 0;
+        EEPROM.put(EEPROM_LOG, spill);
+    }
+};
+
+
+/** A singleton instance of the class.
+ */
+EventLog eventLog;
+
+
+#endif
@@ -11,8 +11,7 @@
  */
 
 
-// #include <CBUS2515.h>           // CBUS 2515 driver and supporting classes
-// #include <CBUSParams.h>
+#include <EEPROM.h>
 
 #include "I2cComms.h"           // I2C comms for SignalBox
 
@@ -32,15 +31,46 @@
 
 
 // Signalbox definitions
+#if NODES_WIDE
+#define OUTPUT_NODE_MAX      64     // Length of output node array.
+#define INPUT_NODE_MAX       24     // Length of input node array, the controller's maximum (8 unless it has a large EEPROM).
+typedef uint64_t OutputNodes;       // Bit map of Output nodes, one bit per node.
+typedef uint32_t InputNodes;        // Bit map of Input nodes, one bit per node.
+#else
 #define OUTPUT_NODE_MAX      32     // Length of output node array.
-#define INPUT_NODE_MAX        8     // Length of input node array.
+#define INPUT_NODE_MAX       16     // Length of input node array, the controller's maximum (8 unless it has a large EEPROM).
+typedef uint32_t OutputNodes;       // Bit map of Output nodes, one bit per node.
+typedef uint16_t InputNodes;        // Bit map of Input nodes, one bit per node.
+#endif
+#define OUTPUT_PIN_MAX        8     // Pins per output node.
+#define INPUT_PIN_MAX        16     // Pins per input node.
+
+
+// Gateway definitions.
+#define GATEWAY_QUEUE_MAX    16     // Requests waiting for the controller to poll.
+#define GATEWAY_COMMAND_LEN   3     // Upstream (serial) command length, eg "h3A".
+
+
+// Event log definitions.
+#define EVENT_LOG_MAX         64    // Records kept in RAM.
+#define EVENT_LOG_SPILL    false    // Move older records to EEPROM (a few milliseconds each). All are moved after an error anyway.
+#define EEPROM_LOG_MAX       100    // Records kept in EEPROM.
 
 
 // CBUS definitions.
-#define CBUS_MAJ               1    // major version
-#define CBUS_MIN             ' '    // minor version
-#define CBUS_BETA              0    // beta
-#define CBUS_ID               99    // CBUS module ID
+#define CBUS_MCP2515       false    // Use an MCP2515 CAN controller (needs the ACAN2515 library), else an in-process loopback.
+#define CBUS_NODE_NUMBER     256    // Our CBUS node number, producing and learning events.
+#define CBUS_CAN_ID           99    // Our CAN ID (1-127).
+#define CBUS_BIT_RATE    125000L    // CBUS bit rate.
+
+#define CBUS_QUEUE_MAX        32    // Events waiting to be sent.
+#define CBUS_QUEUE_ON     0x8000    // Flags an ACON in the event queue (event numbers are less).
+#define CBUS_EVENTS_MAX       32    // Learned events.
+#define CBUS_LOOPBACK_FRAMES   8    // Frames the loopback holds, like the MCP2515's buffers.
+#define CBUS_BENCH_TIMEOUT  1000    // Time (msecs) the 'b' command waits for its events to be sent.
+
+#define EEPROM_CBUS            0    // EEPROM offset of the learned events.
+#define EEPROM_LOG          0xc0    // EEPROM offset of the spilled event log, after the learned events.
 
 #define CBUS_PIN_INT           2    // Interupt pin.
 #define CBUS_PIN_CS           10    // Chip select pin.
@@ -49,3 +79,8 @@
 #define CBUS_PIN_CLK           2    // Clock pin.
 
 #define CBUS_FREQ       8000000L     // CAN2515 board frequency
+
+
+#include "Cbus.h"               // CBUS event layer
+#include "EventLog.h"           // Black-box event log
+
@@ -15,14 +15,9 @@
  *
  *  Name              | Purpose
  *  ----------------- | -------
- *  EEPROM            | Reading and writing to EEPROM memory.
+ *  EEPROM            | Reading and writing to EEPROM memory (learned CBUS events and spilled event log).
  *  Wire              | To handle i2c communications.
- *  ACAN              | CAN BUS communications
- *  CBUS              | CBUS protocol
- *  CBUS2515          | CBUS 2515 interface library
- *  CBUSconfig        | CBUS configuration
- *  cbusdefs          | CBUS constants
- *  CBUSParams        |
+ *  ACAN2515          | MCP2515 CAN controller (only if CBUS_MCP2515).
  *
  *
  *  Pin usage:
@@ -30,6 +25,7 @@
  *  D0      Serial Rx.
  *  D1      Serial Tx.
  *  D2      CAN interupt.
+ *  GATEWAY_ATTENTION_PIN (if any) to the controller's, held low while requests are waiting.
  *  D10     CAN chip-select.
  *  D11     CAN SI.
  *  D12     CAN SO.
@@ -45,98 +41,42 @@
 #include "Gateway.h"
 
 
-// I2C request command parameters
-volatile uint8_t  requestCommand = COMMS_CMD_NONE;
-volatile uint8_t  requestNode    = 0;
+// Requests queued for the controller, sent in batches when it polls (see COMMS_SYS_GATEWAY).
+volatile uint8_t  queueCommand[GATEWAY_QUEUE_MAX];
+volatile uint8_t  queueNode[GATEWAY_QUEUE_MAX];
+volatile uint8_t  queueHead  = 0;
+volatile uint8_t  queueCount = 0;
 
 
-volatile uint8_t  outputNodeCount = 0;
 volatile uint8_t  outputStates[OUTPUT_NODE_MAX];
+volatile uint16_t inputStates[INPUT_NODE_MAX];
 
-volatile uint8_t  inputNodeCount = 0;
-volatile uint16_t inputStates[OUTPUT_NODE_MAX];
-
-
-// CBUS definitions
-//unsigned char moduleName[] = "SB_GW  ";   // CBUS module name, 7 characters.
-//CBUS2515      cbus2515;
-//CBUSConfig    config;                     // Configuration object must be called "config".
-
-
-///** Handle an incomming CBUS frame.
-// */
-//void cbusFrameHandler(CANFrame *aFrame)
-//{
-//    debugPrint(F("Frame"));
-//    debugFrame(aFrame);
-//    debugPrintln();
-//}
-//
-//
-///** Handle an incomming CBUS (learned) event.
-// */
-//void cbusEventHandler(byte index, CANFrame *aFrame)
-//{
-//    debugPrint(F("Event, index="));
-//    debugPrintHex(index);
-//    debugFrame(aFrame);
-//    debugPrintln();
-//}
-//
-//
-///** Debug output of a CANFrame.
-// */
-//void debugFrame(CANFrame *aFrame)
-//{
-//    debugPrint(F(", id="));    
-//    debugPrintHex(aFrame->id);
-//    debugPrint(F(", ext="));
-//    debugPrintHex(aFrame->ext);
-//    debugPrint(F(", rtr="));
-//    debugPrintHex(aFrame->rtr);
-//    debugPrint(F(", len="));
-//    debugPrintHex(aFrame->len);
-//    debugPrint(F(", data="));
-//    for (uint8_t ind = 0; ind < sizeof(aFrame->data); ind++)
-//    {
-//        debugPrintHex(aFrame->data[ind]);
-//        debugPrint(' ');
-//    }
-//}
-//
-//
-///** Initialise CBUS interface.
-// */
-//void initCbus()
-//{
-//    // Configure modules config (persistence of NVs and EVs)
-//    config.EE_NVS_START       = 10;
-//    config.EE_NUM_NVS         = 1;
-//    config.EE_EVENTS_START    = 50;
-//    config.EE_MAX_EVENTS      = 64;
-//    config.EE_NUM_EVS         = 0;
-//    config.EE_BYTES_PER_EVENT = 0;
-//
-//    config.setEEPROMtype(EEPROM_INTERNAL);
-//    config.begin();
-//
-//    // Configure CBUS interface
-//    CBUSParams params(config);
-//    params.setVersion(CBUS_MAJ, CBUS_MIN, CBUS_BETA);
-//    params.setModuleId(CBUS_ID);
-//    params.setFlags(PF_FLiM | PF_PRODUCER);
-//    cbus2515.setParams(params.getParams());
-//
-//    cbus2515.setName(moduleName);
-//    cbus2515.setNumBuffers(2);
-//    cbus2515.setOscFreq(CBUS_FREQ);
-//    cbus2515.setPins(CBUS_PIN_CS, CBUS_PIN_INT);    // Chip select and interupt pins.
-//
-//    cbus2515.setEventHandler(cbusEventHandler);     // Handlers
-//    cbus2515.setFrameHandler(cbusFrameHandler);
-//
-//    cbus2515.begin();
-//}
+// Snapshot of all the states (see COMMS_SYS_SNAPSHOT).
+volatile bool     mirrorCurrent    = false;     // Mirror has been filled by a snapshot.
+volatile bool     snapshotWanted   = true;      // Ask the controller for a snapshot.
+volatile uint8_t  snapshotVersion  = 0;         // Version of the snapshot being received.
+volatile uint8_t  snapshotNext     = 0;         // Offset of the next chunk expected.
+volatile uint8_t  snapshotHi       = 0;         // High byte of an Input node's states.
+
+volatile OutputNodes outputDeltas = 0;          // Output nodes whose mirrored states have changed, not yet published.
+volatile InputNodes  inputDeltas  = 0;          // Input nodes whose mirrored states have changed, not yet published.
+
+
+// Upstream (serial) command.
+char              commandBuffer[GATEWAY_COMMAND_LEN + 1];
+uint8_t           commandLen = 0;
+
+
+// CBUS transport and event layer (see Cbus.h).
+#if CBUS_MCP2515
+Mcp2515Can        canTransport;
+#else
+LoopbackCan       canTransport;
+#endif
+Cbus              cbus(canTransport, CBUS_NODE_NUMBER, CBUS_CAN_ID);
+
+uint8_t           publishedOutputs[OUTPUT_NODE_MAX];    // Output states last published as CBUS events.
+uint16_t          publishedInputs[INPUT_NODE_MAX];      // Input states last published as CBUS events.
 
 
 /** Setup the Arduino.
@@ -144,12 +84,28 @@ volatile uint16_t inputStates[OUTPUT_NODE_MAX];
 void setup()
 {
     Serial.begin(19200);                    // Serial IO.
+    eventLog.begin();                       // Start the black-box log.
 
     i2cComms.setId(I2C_GATEWAY_ID);         // Start I2C communications.
     i2cComms.onReceive(processReceipt);
     i2cComms.onRequest(processRequest);
 
-//    initCbus();                             // Start CBUS communications.
+    if (GATEWAY_ATTENTION_PIN > 0)
+    {
+        digitalWrite(GATEWAY_ATTENTION_PIN, LOW);       // Low when driven, released (floating) otherwise.
+        showAttention();
+    }
+
+    for (uint8_t index = 0; index < CBUS_EVENTS_MAX; index++)
+    {
+        EEPROM.get(EEPROM_CBUS + index * sizeof(CbusEvent), cbus.getEvents()[index]);
+    }
+
+    cbus.onConsume(consumeEvent);           // Start CBUS communications.
+    if (!cbus.begin())
+    {
+        reportError("CAN failed", 0, 0);
+    }
 
     debugPrint(F("Gateway"));
 }
@@ -159,6 +115,8 @@ void setup()
  */
 void reportError(const char* aMessage, uint8_t aCommand, uint8_t aOption)
 {
+    eventLog.add(LOG_ERROR, aCommand, aOption);
+
     debugPrint(millis());
     debugPrint('\t');
     debugPrint(aMessage);
@@ -170,16 +128,112 @@ void reportError(const char* aMessage, uint8_t aCommand, uint8_t aOption)
 }
 
 
+/** Queue a request for the controller.
+ *  Return false if the queue is full.
+ *  Called from the I2C handlers, and from loop() with interrupts disabled.
+ */
+bool queueRequest(uint8_t aCommand, uint8_t aNode)
+{
+    if (queueCount >= GATEWAY_QUEUE_MAX)
+    {
+        return false;
+    }
+
+    uint8_t index = (queueHead + queueCount) % GATEWAY_QUEUE_MAX;
+    queueCommand[index] = aCommand;
+    queueNode[index]    = aNode;
+    queueCount += 1;
+
+    eventLog.add(LOG_REQUEST, aNode, aCommand);
+
+    return true;
+}
+
+
 /** Process a Request (for data).
- *  Send data to master.
+ *  Send the master a batch of queued requests, padded with COMMS_CMD_NONE.
  */
 void processRequest()
 {
-    Wire.write(requestCommand);
-    Wire.write(requestNode & 0x1F);
+    uint8_t count = min(queueCount, COMMS_GATEWAY_BATCH);
+
+    i2cComms.sendByte(count | ((queueCount > count) ? COMMS_GATEWAY_MORE : 0));
+
+    for (uint8_t index = 0; index < COMMS_GATEWAY_BATCH; index++)
+    {
+        if (index < count)
+        {
+            i2cComms.sendByte(queueCommand[queueHead]);
+            i2cComms.sendByte(queueNode[queueHead]);
+            queueHead = (queueHead + 1) % GATEWAY_QUEUE_MAX;
+        }
+        else
+        {
+            i2cComms.sendByte(COMMS_CMD_NONE);
+            i2cComms.sendByte(0);
+        }
+    }
+
+    queueCount -= count;
+
+    showAttention();
+}
+
+
+/** Are there requests waiting for the controller (or will there be when it asks)?
+ */
+bool isWaiting()
+{
+    return (queueCount > 0) || (snapshotWanted);
+}
+
 
-    // Clear pending command.
-    requestCommand = COMMS_CMD_NONE;
+/** Hold the attention pin low while there are requests waiting, else release it.
+ *  Called from the I2C handlers and loop().
+ */
+void showAttention()
+{
+    if (GATEWAY_ATTENTION_PIN > 0)
+    {
+        pinMode(GATEWAY_ATTENTION_PIN, isWaiting() ? OUTPUT : INPUT);
+    }
+}
+
+
+/** Ring the controller's doorbell.
+ *  Sent with Wire itself, not i2cComms: the controller is also a master, and losing arbitration to it
+ *  (endTransmission() 4 or 5) isn't a stuck bus to recover. The doorbell rings again after STEP_GATEWAY anyway.
+ */
+void ringDoorbell()
+{
+    Wire.beginTransmission(I2C_CONTROLLER_ID);
+    Wire.write(COMMS_CMD_SYSTEM | COMMS_SYS_GATEWAY);
+    Wire.endTransmission();
+}
+
+
+/** Tell the controller when there are requests waiting.
+ *  Without an attention pin, ring the controller's doorbell, and again every STEP_GATEWAY until they're collected.
+ *  An RS-485 gateway can't, the controller polls it instead.
+ */
+void signalController()
+{
+    static unsigned long tickRing = 0L;                 // Time to ring the doorbell again.
+
+    if (GATEWAY_ATTENTION_PIN > 0)
+    {
+        showAttention();
+    }
+    else if (   (COMMS_RS485)
+             || (!isWaiting()))
+    {
+        tickRing = 0L;                                  // Ring straight away when requests arrive.
+    }
+    else if (millis() >= tickRing)
+    {
+        tickRing = millis() + STEP_GATEWAY;
+        ringDoorbell();
+    }
 }
 
 
@@ -193,7 +247,6 @@ void processReceipt(int aLen)
         // Read the command byte.
         uint8_t command = i2cComms.readByte();
         uint8_t option  = command & COMMS_OPTION_MASK;
-        uint8_t pin     = option  & 0x07;
 
         command &= COMMS_COMMAND_MASK;
 
@@ -214,12 +267,6 @@ void processReceipt(int aLen)
             case COMMS_CMD_SYSTEM: processSystem(option);
                                    break;
 
-            case COMMS_CMD_SET_LO:
-            case COMMS_CMD_SET_HI:
-            case COMMS_CMD_INP_LO:
-            case COMMS_CMD_INP_HI: processStateChange(command, pin);
-                                   break;
-
             default:               reportError("Unrecognised", command, option);
                                    break;
         }
@@ -264,35 +311,18 @@ void processSystem(uint8_t aOption)
 {
     switch (aOption)
     {
-        case COMMS_SYS_GATEWAY:    // At startup, the first polls are used to populate the output and input node states.
-                                   if (outputNodeCount < OUTPUT_NODE_MAX)
+        case COMMS_SYS_GATEWAY:    // Ask for a snapshot if we've missed the controller's start-up one.
+                                   if (   (snapshotWanted)
+                                       && (queueRequest(COMMS_CMD_SYSTEM | COMMS_SYS_SNAPSHOT, 0)))
                                    {
-                                       requestCommand = COMMS_CMD_SYSTEM | COMMS_SYS_OUT_STATES;   // Ask for (next) Output node's states.
-                                       requestNode = outputNodeCount;
+                                       snapshotWanted = false;
                                    }
-                                   else if (inputNodeCount < INPUT_NODE_MAX)
-                                   {
-                                       requestCommand = COMMS_CMD_SYSTEM | COMMS_SYS_INP_STATES;   // Ask for (next) Input node's states.
-                                       requestNode = inputNodeCount;
-                                   }
-                                   else
-                                   {
-                                       // TODO - handle pending requests.
-                                   }
-
                                    break;
 
-        case COMMS_SYS_OUT_STATES: if (i2cComms.available() == 1)
+        case COMMS_SYS_OUT_STATES: if (i2cComms.available() == 2)
                                    {
-                                       outputStates[outputNodeCount] = i2cComms.readByte();
-                                       debugPrint(millis());
-                                       debugPrint(F("\tOutput node="));
-                                       debugPrintHex(outputNodeCount);
-                                       debugPrint(F(", states="));
-                                       debugPrintHex(outputStates[outputNodeCount]);
-                                       debugPrintln();
-
-                                       outputNodeCount += 1;                    // Ensure next request is for next node
+                                       uint8_t node = i2cComms.readByte() % OUTPUT_NODE_MAX;
+                                       mirrorOutput(node, i2cComms.readByte());
                                    }
                                    else
                                    {
@@ -301,17 +331,11 @@ void processSystem(uint8_t aOption)
 
                                    break;
 
-        case COMMS_SYS_INP_STATES: if (i2cComms.available() != 2)
+        case COMMS_SYS_INP_STATES: if (i2cComms.available() == 3)
                                    {
-                                       inputStates[inputNodeCount] = (i2cComms.readByte() << 8) | i2cComms.readByte();
-                                       debugPrint(millis());
-                                       debugPrint(F("\tInput  node="));
-                                       debugPrintHex(inputNodeCount);
-                                       debugPrint(F(", states="));
-                                       debugPrintHex(inputStates[inputNodeCount]);
-                                       debugPrintln();
-
-                                       inputNodeCount += 1;                    // Ensure next request is for next node
+                                       uint8_t  node   = i2cComms.readByte() % INPUT_NODE_MAX;
+                                       uint16_t states = i2cComms.readByte() << 8;
+                                       mirrorInput(node, states | i2cComms.readByte());
                                    }
                                    else
                                    {
@@ -320,92 +344,519 @@ void processSystem(uint8_t aOption)
 
                                    break;
 
+        case COMMS_SYS_CHANGES:    processChanges();
+                                   break;
+
+        case COMMS_SYS_SNAPSHOT:   processSnapshot();
+                                   break;
+
         default:                   reportError("Unrecognised system", COMMS_CMD_SYSTEM, aOption);
     }
 }
 
 
-/** Process a state-change command.
+/** Process the changed node states sent by the controller.
+ *  Node masks, then the states of each node in the masks.
  */
-void processStateChange(uint8_t aCommand, uint8_t aPin)
+void processChanges()
 {
-    uint8_t node     = 0;
-    uint8_t delay    = 0;
-    boolean isOutput =    (aCommand == COMMS_CMD_SET_LO)
-                       || (aCommand == COMMS_CMD_SET_HI);
-    boolean isHi     =    (aCommand == COMMS_CMD_INP_HI)
-                       || (aCommand == COMMS_CMD_SET_HI);
+    uint8_t masks[COMMS_CHANGES_MASKS];
 
-    if (i2cComms.available())           // Should be present for all state change commands.
+    if (i2cComms.available() < COMMS_CHANGES_MASKS)
     {
-        node = i2cComms.readByte();
+        reportError("Missing changes", COMMS_CMD_SYSTEM | COMMS_SYS_CHANGES, i2cComms.available());
+        return;
     }
 
-    if (i2cComms.available())           // Set commands only.
+    for (uint8_t index = 0; index < COMMS_CHANGES_MASKS; index++)
     {
-        delay = i2cComms.readByte();
+        masks[index] = i2cComms.readByte();
     }
 
-    debugPrint(millis());
-    debugPrint('\t');
-    debugPrint(isOutput ? F("Output ") : F("Input "));
-    debugPrint(isHi ? F("Hi") : F("Lo"));
-    debugPrint(F(", node="));
-    debugPrintHex(node);
-    debugPrint(F(", pin="));
-    debugPrintHex(aPin);
-    if (isOutput)
+    for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+    {
+        if (   (masks[node >> 3] & (1 << (node & 7)))
+            && (i2cComms.available() >= 1))
+        {
+            mirrorOutput(node, i2cComms.readByte());
+        }
+    }
+
+    for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
+    {
+        if (   (masks[COMMS_CHANGES_OUTPUTS + (node >> 3)] & (1 << (node & 7)))
+            && (i2cComms.available() >= 2))
+        {
+            uint16_t states = i2cComms.readByte() << 8;
+            mirrorInput(node, states | i2cComms.readByte());
+        }
+    }
+}
+
+
+/** Process a chunk of a state snapshot.
+ *  Output node states, then Input node states (high byte first).
+ *  A chunk at offset zero starts a new snapshot, later chunks must follow on from the same version.
+ */
+void processSnapshot()
+{
+    if (i2cComms.available() < COMMS_SNAPSHOT_HEADER)
+    {
+        reportError("Missing snapshot", COMMS_CMD_SYSTEM | COMMS_SYS_SNAPSHOT, i2cComms.available());
+        return;
+    }
+
+    uint8_t version = i2cComms.readByte();
+    uint8_t offset  = i2cComms.readByte();
+    uint8_t total   = i2cComms.readByte();
+
+    if (offset == 0)
+    {
+        snapshotVersion = version;
+        snapshotNext    = 0;
+        mirrorCurrent   = false;
+        snapshotWanted  = false;                    // The controller is already sending one.
+        eventLog.add(LOG_SNAPSHOT, version, total);
+    }
+
+    if (   (version != snapshotVersion)
+        || (offset  != snapshotNext))
+    {
+        reportError("Snapshot out of sequence", version, offset);
+        snapshotWanted = true;                      // Ask for another.
+        return;
+    }
+
+    for (uint8_t index = offset; i2cComms.available(); index++)
+    {
+        uint8_t value = i2cComms.readByte();
+
+        if (index < OUTPUT_NODE_MAX)
+        {
+            mirrorOutput(index, value);
+        }
+        else if (((index - OUTPUT_NODE_MAX) & 1) == 0)
+        {
+            snapshotHi = value;
+        }
+        else if (((index - OUTPUT_NODE_MAX) >> 1) < INPUT_NODE_MAX)
+        {
+            mirrorInput((index - OUTPUT_NODE_MAX) >> 1, (snapshotHi << 8) | value);
+        }
+
+        snapshotNext = index + 1;
+    }
+
+    if (snapshotNext >= total)
+    {
+        mirrorCurrent = true;
+    }
+}
+
+
+/** Update the mirror of an Output node's states.
+ *  Mark the node for publishing if its states have changed.
+ */
+void mirrorOutput(uint8_t aNode, uint8_t aStates)
+{
+    if (outputStates[aNode] != aStates)
+    {
+        outputStates[aNode] = aStates;
+        outputDeltas |= (OutputNodes)1 << aNode;
+        eventLog.add(LOG_OUTPUT, aNode, aStates);
+    }
+}
+
+
+/** Update the mirror of an Input node's states.
+ *  Mark the node for publishing if its states have changed.
+ */
+void mirrorInput(uint8_t aNode, uint16_t aStates)
+{
+    if (inputStates[aNode] != aStates)
+    {
+        inputStates[aNode] = aStates;
+        inputDeltas |= (InputNodes)1 << aNode;
+        eventLog.add(LOG_INPUT, aNode, aStates);
+    }
+}
+
+
+/** Publish the nodes whose mirrored states have changed.
+ */
+void publishChanges()
+{
+    static bool wasCurrent = false;
+
+    if (mirrorCurrent != wasCurrent)
+    {
+        wasCurrent = mirrorCurrent;
+        debugPrint(millis());
+        debugPrint(F("\tSnapshot version="));
+        debugPrintHex(snapshotVersion);
+        debugPrint(wasCurrent ? F(" complete") : F(" started"));
+        debugPrintln();
+    }
+
+    if ((outputDeltas | inputDeltas) == 0)
+    {
+        return;
+    }
+
+    noInterrupts();
+    OutputNodes outputs = outputDeltas;
+    InputNodes  inputs  = inputDeltas;
+    outputDeltas = 0;
+    inputDeltas  = 0;
+    interrupts();
+
+    for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+    {
+        if (outputs & ((OutputNodes)1 << node))
+        {
+            uint8_t states = outputStates[node];
+            produceEvents(true, node, states, publishedOutputs[node], OUTPUT_PIN_MAX);
+            publishedOutputs[node] = states;
+
+            debugPrint(millis());
+            debugPrint(F("\tOutput node="));
+            debugPrintHex(node);
+            debugPrint(F(", states="));
+            debugPrintHex(states);
+            debugPrintln();
+        }
+    }
+
+    for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
+    {
+        if (inputs & ((InputNodes)1 << node))
+        {
+            uint16_t states = inputStates[node];
+            produceEvents(false, node, states, publishedInputs[node], INPUT_PIN_MAX);
+            publishedInputs[node] = states;
+
+            debugPrint(millis());
+            debugPrint(F("\tInput  node="));
+            debugPrintHex(node);
+            debugPrint(F(", states="));
+            debugPrintHex(states);
+            debugPrintln();
+        }
+    }
+}
+
+
+/** Produce CBUS events for the pins whose states differ from those last published.
+ */
+void produceEvents(bool aIsOutput, uint8_t aNode, uint16_t aStates, uint16_t aPublished, uint8_t aPins)
+{
+    uint16_t changed = aStates ^ aPublished;
+
+    for (uint8_t pin = 0; pin < aPins; pin++)
+    {
+        if (   (changed & (1 << pin))
+            && (!cbus.produce(aIsOutput, aNode, pin, aStates & (1 << pin))))
+        {
+            reportError("CBUS queue full", aNode, pin);
+        }
+    }
+}
+
+
+/** Consume a learned CBUS event, queueing its request for the controller.
+ */
+void consumeEvent(uint8_t aCommand, uint8_t aNode)
+{
+    noInterrupts();
+    bool queued = queueRequest(aCommand, aNode);
+    interrupts();
+
+    if (!queued)
     {
-        debugPrint(F(", delay="));
-        debugPrintHex(delay);
+        reportError("Queue full", aCommand, aNode);
     }
+}
+
+
+/** Save the learned CBUS events, if they've changed.
+ */
+void saveEvents()
+{
+    if (cbus.isEventsChanged())
+    {
+        for (uint8_t index = 0; index < CBUS_EVENTS_MAX; index++)
+        {
+            EEPROM.put(EEPROM_CBUS + index * sizeof(CbusEvent), cbus.getEvents()[index]);
+        }
+    }
+}
+
+
+/** Report CBUS statistics, and the rate frames have been sent since start-up.
+ */
+void reportCbus()
+{
+    uint32_t now = millis();
+
+    debugPrint(now);
+    debugPrint(F("	CBUS sent="));
+    debugPrint(cbus.getFramesSent());
+    debugPrint(F(", received="));
+    debugPrint(cbus.getFramesReceived());
+    debugPrint(F(", produced="));
+    debugPrint(cbus.getEventsProduced());
+    debugPrint(F(", merged="));
+    debugPrint(cbus.getEventsMerged());
+    debugPrint(F(", consumed="));
+    debugPrint(cbus.getEventsConsumed());
+    debugPrint(F(", frames/sec="));
+    debugPrint(cbus.getFramesSent() * 1000 / max(now, 1UL));
     debugPrintln();
+}
+
+
+#if !CBUS_MCP2515
+/** Measure CBUS event throughput.
+ *  Produce an event for every Output pin, and time how long it takes to send them all.
+ *  Only over the loopback, as the events would be real ones on a CAN bus.
+ */
+void benchCbus()
+{
+    uint32_t sent  = cbus.getFramesSent();
+    uint32_t start = micros();
+
+    for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+    {
+        for (uint8_t pin = 0; pin < OUTPUT_PIN_MAX; pin++)
+        {
+            while (!cbus.produce(true, node, pin, (node + pin) & 1))
+            {
+                cbus.update();                          // Queue full, send some.
+            }
+        }
+    }
+
+    while (   (cbus.getFramesSent() - sent < OUTPUT_NODE_MAX * OUTPUT_PIN_MAX)
+           && (micros() - start < CBUS_BENCH_TIMEOUT * 1000UL))
+    {
+        cbus.update();
+    }
 
-//    sendCbusMessage((isHi     ? OPC_ACON    : OPC_ACON), 
-//                    (isOutput ? 1           : 0),
-//                    (isOutput ? (node << 3) : (node << 4)) | aPin);
+    uint32_t elapsed = micros() - start;
+    uint32_t events  = cbus.getFramesSent() - sent;
+
+    debugPrint(millis());
+    debugPrint(F("	CBUS events="));
+    debugPrint(events);
+    debugPrint(F(", usecs="));
+    debugPrint(elapsed);
+    debugPrint(F(", events/sec="));
+    debugPrint(events * 1000000UL / max(elapsed, 1UL));
+    debugPrintln();
 }
+#endif
 
 
-///** Send a CBUS message.
-// */
-//void sendCbusMessage(uint8_t aOpCode, uint8_t aEventHi, uint8_t aEventLo)
-//{
-//    CANFrame frame;
-//    frame.id      = config.CANID;
-//    frame.len     = 5;
-//    frame.data[0] = aOpCode;
-//    frame.data[1] = highByte(config.nodeNum);
-//    frame.data[2] = lowByte(config.nodeNum);
-//    frame.data[3] = aEventHi;
-//    frame.data[4] = aEventLo;
-//
-//    boolean sent = cbus2515.sendMessage(&frame);
-//
-//    debugPrint(millis());
-//    debugPrint('\t');
-//    debugPrint(F("CBUS, opCode="));
-//    debugPrintHex(aOpCode);
-//    debugPrint(F(", EventHi="));
-//    debugPrintHex(aEventHi);
-//    debugPrint(F(", EventLo="));
-//    debugPrintHex(aEventLo);
-//    if (sent)
-//    {
-//        debugPrint(F(" sent"));
-//    }
-//    else
-//    {
-//        debugPrint(F(" fail"));
-//    }
-//    debugPrintln();
-//}
+/** Convert a hex (base 32) character to its value.
+ *  Return a negative number if it isn't one.
+ */
+int hexValue(char aChar)
+{
+    if ((aChar >= '0') && (aChar <= '9'))
+    {
+        return aChar - '0';
+    }
+
+    aChar |= 0x20;                                      // Lower-case.
+    if ((aChar >= 'a') && (aChar <= 'v'))
+    {
+        return aChar - 'a' + 10;
+    }
+
+    return -1;
+}
+
+
+/** Convert a node character to its node number.
+ *  Wide node numbers (NODES_WIDE) use the lower-case letters too (as the controller's HEX_CHARS), so are case-sensitive.
+ *  Return a negative number if it isn't one.
+ */
+int nodeValue(char aChar)
+{
+#if NODES_WIDE
+    if ((aChar >= 'A') && (aChar <= 'Z'))
+    {
+        return aChar - 'A' + 10;
+    }
+
+    if ((aChar >= 'a') && (aChar <= 'z'))
+    {
+        return aChar - 'a' + 36;
+    }
+
+    if (aChar == '$')
+    {
+        return 62;
+    }
+
+    if (aChar == '&')
+    {
+        return 63;
+    }
+#endif
+
+    return hexValue(aChar);
+}
+
+
+/** Process an upstream command, queueing a request for the controller.
+ *      iNP - Action input for node N, pin P.
+ *      lNP - Set output Lo for node N, pin P.
+ *      hNP - Set output Hi for node N, pin P.
+ *      r   - Refresh all the output and input node states (with a snapshot).
+ *      s   - Report CBUS statistics.
+ *      b   - Benchmark CBUS event throughput (loopback only).
+ *      d   - Dump the event log (see EventLog.h).
+ *      e   - Erase the event log.
+ */
+void processCommand()
+{
+    int     node    = (commandLen > 1) ? nodeValue(commandBuffer[1]) : -1;
+    int     pin     = (commandLen > 2) ? hexValue(commandBuffer[2]) : -1;
+    uint8_t command = COMMS_CMD_NONE;
+
+    switch (commandBuffer[0] | 0x20)
+    {
+        case 'i': if (   (node >= 0) && (node < INPUT_NODE_MAX)
+                      && (pin  >= 0) && (pin  < INPUT_PIN_MAX))
+                  {
+                      command = COMMS_CMD_INP_LO | pin;
+                  }
+                  break;
+
+        case 'l':
+        case 'h': if (   (node >= 0) && (node < OUTPUT_NODE_MAX)
+                      && (pin  >= 0) && (pin  < OUTPUT_PIN_MAX))
+                  {
+                      command = ((commandBuffer[0] | 0x20) == 'h' ? COMMS_CMD_SET_HI : COMMS_CMD_SET_LO) | pin;
+                  }
+                  break;
+
+        case 'r': if (commandLen == 1)
+                  {
+                      snapshotWanted = true;            // Next poll asks for a snapshot.
+                      return;
+                  }
+                  break;
+
+        case 's': if (commandLen == 1)
+                  {
+                      reportCbus();
+                      return;
+                  }
+                  break;
+
+#if !CBUS_MCP2515
+        case 'b': if (commandLen == 1)
+                  {
+                      benchCbus();
+                      return;
+                  }
+                  break;
+#endif
+
+        case 'd': if (commandLen == 1)
+                  {
+                      eventLog.dump();
+                      return;
+                  }
+                  break;
+
+        case 'p': if (commandLen == 1)
+                  {
+                      eventLog.preserve();
+                      return;
+                  }
+                  break;
+
+        case 'e': if (commandLen == 1)
+                  {
+                      eventLog.erase();
+                      return;
+                  }
+                  break;
+
+        default:  break;
+    }
+
+    if (command == COMMS_CMD_NONE)
+    {
+        reportError("Unrecognised command", commandBuffer[0], commandLen);
+    }
+    else
+    {
+        noInterrupts();
+        bool queued = queueRequest(command, node);
+        interrupts();
+
+        if (!queued)
+        {
+            reportError("Queue full", command, node);
+        }
+    }
+}
+
+
+/** Read upstream (serial) commands, separated by newlines or commas.
+ *  Not if Serial is carrying an RS-485 bus.
+ */
+void processSerial()
+{
+    while (   (   (!COMMS_RS485)
+               || (RS485_SOFTWARE))
+           && (Serial.available() > 0))
+    {
+        char ch = Serial.read();
+
+        if (   (ch == '\n')
+            || (ch == ',')
+            || (ch == '\r'))
+        {
+            if (commandLen > 0)
+            {
+                commandBuffer[commandLen] = 0;
+                processCommand();
+                commandLen = 0;
+            }
+        }
+        else if (commandLen < GATEWAY_COMMAND_LEN)
+        {
+            commandBuffer[commandLen++] = ch;
+        }
+    }
+}
 
 
 /** Main loop.
  */
 void loop()
 {
-//    // Process CBUS stuff
-//    cbus2515.process();
+    // Process messages from an RS-485 bus (Wire uses interrupts).
+    i2cComms.update();
+
+    // Process upstream commands.
+    processSerial();
+
+    // Tell the controller if there are requests waiting.
+    signalController();
+
+    // Publish state changes upstream, and as CBUS events.
+    publishChanges();
+
+    // Send and receive CBUS events.
+    cbus.update();
+    saveEvents();
+
+    // Spill (or preserve) the event log to EEPROM.
+    eventLog.update();
 }
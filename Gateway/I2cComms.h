@@ -30,11 +30,14 @@
  *  Messages:
  *
  *      Command Option      Data                    Response
- *      SYSTEM  GATEWAY                             <Request>    <Node>
+ *      SYSTEM  GATEWAY                             <Count> <Request> <Node> ... (COMMS_GATEWAY_BATCH pairs)
  *      SYSTEM  OUT_STATES                          <OutStates>
  *      SYSTEM  INP_STATES                          <InpStates>
  *      SYSTEM  RENUMBER    <Node>      <NewNode>   <NewNode>
  *      SYSTEM  MOVE_LOCKS  <Node>      <NewNode>
+ *      SYSTEM  ENUMERATE   <Step>      <Arg>       <Vote>
+ *      SYSTEM  CHANGES     <OutMask> <InpMask> <OutStates>... <InpStates>...
+ *      SYSTEM  SNAPSHOT    <Version> <Offset> <Total> <State bytes>...
  *
  *      DEBUG   <Level>
  *      SET_LO  <Pin>       <Node>      <Delay>
@@ -50,6 +53,9 @@
  *      INP_LO  <Pin>       <Node>
  *      INP_HI  <Pin>       <Node>
  *
+ *      READ_ALL <Page>                             <OutputDefs> <Checksum>
+ *      WRITE_FIELDS <Pin>  <Fields>
+ *
  *      NONE    0xf
  *
  *
@@ -61,14 +67,30 @@
  *      Delay       Optional delay (in seconds, 0-255) before actioning the command.
  *      OutputDef   15 bytes defining an output. See below.
  *      Value       Value to set output to (0-255).
+ *      Step        The enumeration step, see COMMS_ENUM_... and "Enumeration" below.
+ *      OutMask     Four bytes, least significant first, bit set for each Output node whose states follow.
+ *      InpMask     Two bytes, least significant first, bit set for each Input node whose states follow.
+ *      Version     Identifies a snapshot, so chunks of different snapshots aren't mixed.
+ *      Offset      Offset of the chunk's first byte in the snapshot.
+ *      Total       Length of the whole snapshot: OutStates of every Output node, then InpStates of every Input node.
+ *      Arg         The enumeration step's bit number (0-31) or node number (0-31).
+ *      Page        The first page (0-3) of a bulk read. Each page holds two OutputDefs.
+ *      Fields      A mask byte (see OUTPUT_FIELD_...) then just the masked fields of an OutputDef, in its wire order.
  *
  * Response bytes
- *      Request     The command (and option) requested by the gateway.
+ *      Count       Number of the gateway's requests that follow, with COMMS_GATEWAY_MORE set if more are queued.
+ *      Request     The command (and option) requested by the gateway. Unused pairs are COMMS_CMD_NONE.
  *      OutStates   The current state of all output pins. Pin 0 in bit 0, to Pin 7 in bit 7. Bit set = pin is "Hi".
  *      InpStates   The current state of all input pins. High-order byte first, Pin 8 in bit 0, to Pin 15 in bit 7. Bit set = pin is "Hi".
  *                                                  then Low-order byte second, Pin 0 in bit 0, to Pin 7 in bit 7. Bit set = pin is "Hi".
  *      NewNode     The new node number (0-31) of the output module.
+ *      Vote        0x00 if any enumeration candidate has a zero in the requested bit, else 0xff.
+ *                  For an ASSIGN step, the node number taken by the remaining candidate.
+ *                  For a CHECK step, the check byte then its complement.
  *      OutputDef   15 bytes defining an output. See below.
+ *      OutputDefs  The OutputDefs (2 x 15 bytes) of the requested page.
+ *                  Each subsequent request returns the next page until the node's eight OutputDefs have been sent.
+ *      Checksum    Running checksum of every OutputDef from pin 0 to the end of this page. See I2cComms.checksum().
  *
  * OutputDef
  *      Type        Byte indicating the type of output (see OUTPUT_TYPE_...).
@@ -80,13 +102,68 @@
  *      LocksLo     Four bytes indicating the 4 Lo locks. See Lock below.
  *      LocksHi     Four bytes indicating the 4 Hi locks. See Lock below.
  *      Lock        Byte defining an output node and pin. Node number (0-31) in top 5 bits, pin number (0-7) in bottom 3 bits. See OUTPUT_NODE_... and OUTPUT_PIN_...
+ *
+ *
+ *  Enumeration.
+ *
+ *  OutputModules without a node number (see SYS_MODULE_ID_UNASSIGNED) all answer at I2C_ENUM_ID.
+ *  Each picks a random 32-bit unique ID, and check byte, at START. Responses from several modules are ANDed by the bus,
+ *  so the master searches the unique IDs a bit at a time:
+ *      START           All unassigned modules become candidates, and pick new unique IDs (allow COMMS_ENUM_DELAY).
+ *      VOTE    <Bit>   Candidates vote 0x00 if their ID has a zero in the bit, non-candidates vote 0xff.
+ *      DROP    <Bit>   Sent if the vote was 0x00, candidates with a one in the bit drop out.
+ *      ASSIGN  <Node>  After all 32 bits, one candidate remains. It takes the node number and leaves I2C_ENUM_ID.
+ *      CHECK           Sent to the new node, which answers with its check byte and the byte's complement.
+ *                      If two modules had the same unique ID, both answer and the bytes aren't complements.
+ *      RELEASE         Sent to the new node if the check failed. The modules become unassigned again.
+ *  Repeated until no module answers at I2C_ENUM_ID.
+ *  Only on I2C, which relies on the bus ANDing the answers. On RS-485 several answers would collide, so modules use their jumpers.
+ *
+ *
+ *  Gateway.
+ *
+ *  The gateway signals when it has requests queued, by holding GATEWAY_ATTENTION_PIN low, or else by ringing
+ *  the master's doorbell: briefly becoming an I2C master to send SYSTEM GATEWAY to I2C_CONTROLLER_ID.
+ *  It rings again every STEP_GATEWAY until the requests are collected, or if it loses arbitration to the master.
+ *  Both are masters then, so a failed transfer needn't be a stuck bus, see checkBus(). An RS-485 gateway can't ring,
+ *  so without the attention pin the master polls it every STEP_GATEWAY.
+ *
+ *  The master sends the gateway SYSTEM GATEWAY and reads back a batch of its queued requests:
+ *      SYSTEM OUT_STATES <Node>    Master replies with SYSTEM OUT_STATES <Node> <OutStates>.
+ *      SYSTEM INP_STATES <Node>    Master replies with SYSTEM INP_STATES <Node> <InpStates>.
+ *      SET_LO/SET_HI <Pin> <Node>  Master sets the Output's state.
+ *      INP_LO/INP_HI <Pin> <Node>  Master actions the Input as if its switch went Lo/Hi.
+ *  The master polls again straight away while COMMS_GATEWAY_MORE is set.
+ *  Every STEP_GATEWAY_CHANGES, the master sends SYSTEM CHANGES with the nodes whose states have changed,
+ *  so the gateway keeps a mirror of all the states.
+ *  At start-up, or when the gateway asks (SYSTEM SNAPSHOT), the master sends all the states in a few SNAPSHOT chunks.
+ *
+ *
+ *  Multiplexer segments.
+ *
+ *  If I2C_MUX_MAX is non-zero, the input and output nodes are spread across the channels (segments)
+ *  of one or more TCA9548A multiplexers to keep the capacitance of each electrical segment low.
+ *  The top bits of a node number are its segment, see I2C_SEGMENT_SHIFT, so nodes 0-7 are on segment 0,
+ *  nodes 8-15 on segment 1 and so on. Each multiplexer has eight segments.
+ *
+ *  Input nodes (MCP23017s) use their address within the segment (0-7), so each segment can hold a full set of eight.
+ *  Output modules keep their full node number as their address, they must be fitted to the segment their node number dictates.
+ *  With wide node numbers (NODES_WIDE) there are too many Output nodes for that, so Output modules use their
+ *  address within the segment too (see I2C_OUTPUT_ID_MASK), and wide node numbers need the multiplexers on I2C.
+ *  The LCD and Gateway stay on the main bus, upstream of the multiplexers, so they're on every segment too:
+ *  a node with the LCD's address would collide with it whichever segment it was on.
+ *
+ *  inputId() and outputId() return a bus ID, the node's I2C ID with its segment (plus one) in the high byte.
+ *  Main bus IDs have a zero high byte. Each transfer selects the bus ID's segment before addressing the node,
+ *  and fails (see I2C_ERROR_SEGMENT) if the multiplexer doesn't answer.
+ *  The selected segment is remembered so consecutive transfers to the same segment don't re-select it.
  */
 
 #ifndef I2cComms_h
 #define I2cComms_h
 
 
-#include <Wire.h>
+#include "Transport.h"
 
 
 // Command byte.
@@ -110,6 +187,9 @@ const uint8_t COMMS_CMD_SET         = 0x80;     // Set output to a discrete valu
 const uint8_t COMMS_CMD_INP_LO      = 0x90;     // Input went Lo
 const uint8_t COMMS_CMD_INP_HI      = 0xA0;     // Input went Hi
 
+const uint8_t COMMS_CMD_READ_ALL    = 0xB0;     // Read all the Output definitions, a page at a time (to the I2C master).
+const uint8_t COMMS_CMD_WRITE_FIELDS= 0xC0;     // Write some fields of an Output's definition (from the I2C master).
+
 const uint8_t COMMS_CMD_NONE        = 0xf0;     // Null command.
 
 
@@ -119,6 +199,117 @@ const uint8_t COMMS_SYS_OUT_STATES  = 0x01;     // System - Output states sub-co
 const uint8_t COMMS_SYS_INP_STATES  = 0x02;     // System - Input states sub-command.
 const uint8_t COMMS_SYS_RENUMBER    = 0x03;     // System - renumber node sub-command.
 const uint8_t COMMS_SYS_MOVE_LOCKS  = 0x04;     // System - renumber lock node numbers.
+const uint8_t COMMS_SYS_ENUMERATE   = 0x05;     // System - enumerate unassigned output modules.
+const uint8_t COMMS_SYS_CHANGES     = 0x06;     // System - changed Input and Output node states (to the gateway).
+const uint8_t COMMS_SYS_SNAPSHOT    = 0x07;     // System - all Input and Output node states (to the gateway).
+
+// Enumeration steps.
+const uint8_t COMMS_ENUM_START      = 0x00;     // Make all unassigned modules candidates.
+const uint8_t COMMS_ENUM_VOTE       = 0x01;     // Candidates vote on a bit of their unique ID.
+const uint8_t COMMS_ENUM_DROP       = 0x02;     // Candidates with a one in the bit drop out.
+const uint8_t COMMS_ENUM_ASSIGN     = 0x03;     // The remaining candidate takes a node number.
+const uint8_t COMMS_ENUM_CHECK      = 0x04;     // The assigned module answers with its check byte and its complement.
+const uint8_t COMMS_ENUM_RELEASE    = 0x05;     // The assigned module (or modules) become unassigned again.
+const uint8_t COMMS_ENUM_CHECK_LEN  =    2;     // Length of the CHECK response.
+const uint8_t COMMS_ENUM_RETRIES    =    3;     // Times to try again if two modules take a node.
+const long    COMMS_ENUM_DELAY      =  400;     // Time (msecs) for candidates to pick unique IDs after START.
+const uint8_t COMMS_ENUM_BITS       =   32;     // Bits in a unique ID.
+const uint8_t COMMS_ENUM_ZERO       = 0x00;     // Vote for a zero bit.
+const uint8_t COMMS_ENUM_NONE       = 0xff;     // Vote for a one bit, or no vote (neutral when ANDed).
+
+// Gateway requests.
+const uint8_t COMMS_GATEWAY_BATCH   =    4;     // Requests returned per GATEWAY poll.
+const uint8_t COMMS_GATEWAY_LEN     = 1 + COMMS_GATEWAY_BATCH * 2;  // Count, then Request and Node pairs.
+const uint8_t COMMS_GATEWAY_MORE    = 0x80;     // Count flag, more requests are queued.
+const uint8_t COMMS_GATEWAY_COUNT   = 0x7f;     // Count mask.
+const uint8_t COMMS_CHANGES_OUTPUTS = NODES_WIDE ?  8 : 4;    // Bytes of the Output node mask in a CHANGES message.
+const uint8_t COMMS_CHANGES_MASKS   = NODES_WIDE ? 11 : 6;    // Bytes of node masks (Output, then Input) in a CHANGES message.
+const uint8_t COMMS_CHANGES_MAX     = BUFFER_LENGTH - 1;    // Data bytes in a CHANGES message.
+const uint8_t COMMS_SNAPSHOT_HEADER =    3;     // Version, Offset and Total.
+const uint8_t COMMS_SNAPSHOT_CHUNK  = (BUFFER_LENGTH - 1 - COMMS_SNAPSHOT_HEADER) & ~1;    // State bytes per chunk (even, so Input nodes aren't split).
+
+
+// Multiplexer segments.
+const uint8_t I2C_SEGMENT_NONE      = 0xff;     // No segment selected, or selection unknown.
+const uint8_t I2C_SEGMENT_SHIFT     =    3;     // Shift node number this amount to get its segment.
+const uint8_t I2C_SEGMENT_MASK      =    7;     // Mask for a node's address within its segment.
+const uint8_t I2C_MUX_SHIFT         =    3;     // Shift segment this amount to get its multiplexer (8 segments each).
+const uint8_t I2C_ERROR_SEGMENT     =    4;     // Transfer result if the segment couldn't be selected (Wire's "other error").
+
+
+// Output module IDs.
+const uint8_t I2C_OUTPUT_NODES      = NODES_WIDE ? 64 : 32;     // IDs from I2C_OUTPUT_BASE_ID used by Output modules.
+
+static_assert(   (!NODES_WIDE)
+              || (COMMS_RS485)
+              || (I2C_MUX_MAX > 0),                              "Wide node numbers need I2C multiplexers (or RS-485)");
+static_assert(   (!COMMS_RS485)
+              || (I2C_MUX_MAX == 0)
+              || (I2C_MUX_BASE_ID >= I2C_OUTPUT_BASE_ID + I2C_OUTPUT_NODES)
+              || (I2C_MUX_BASE_ID + I2C_MUX_MAX <= I2C_OUTPUT_BASE_ID), "Output module IDs overlap the multiplexers, move I2C_OUTPUT_BASE_ID");
+
+
+// Bus recovery.
+const uint8_t I2C_RECOVERY_CLOCKS   =    9;     // Clock out at most a byte and an ack to release a stuck slave.
+const uint8_t I2C_RECOVERY_DELAY    =    5;     // Half-period (microseconds) of the recovery clock, 100kHz.
+const uint16_t I2C_STUCK_MICROS    = 4000;     // SDA held low longer than the longest transfer (33 bytes at 100kHz) is stuck.
+
+
+const uint8_t WIRE_LAYOUT_NONE      = 0xff;     // wireOffset() of an object byte that isn't on the wire.
+
+
+/** Compile-time description of a definition's wire layout.
+ *  Each parameter is the offset (within the object) of the next byte on the wire.
+ *  encode() and decode() unroll into straight copies between the object and a wire buffer.
+ *  wireOffset() finds an object byte on the wire, so a definition can check its layout with static_asserts.
+ */
+template <uint8_t... OFFSETS> struct WireLayout;
+
+
+/** The end of a wire layout.
+ */
+template <> struct WireLayout<>
+{
+    static const uint8_t SIZE = 0;
+
+    static constexpr uint8_t wireOffset(uint8_t aOffset) { return WIRE_LAYOUT_NONE; }
+
+    static void encode(const uint8_t* aObject, uint8_t* aBuffer) { }
+    static void decode(uint8_t* aObject, const uint8_t* aBuffer) { }
+};
+
+
+/** A byte of a wire layout, followed by the rest of the layout.
+ */
+template <uint8_t OFFSET, uint8_t... REST> struct WireLayout<OFFSET, REST...>
+{
+    static const uint8_t SIZE = 1 + WireLayout<REST...>::SIZE;
+
+    /** Offset on the wire of the given object byte, WIRE_LAYOUT_NONE if it isn't there.
+     */
+    static constexpr uint8_t wireOffset(uint8_t aOffset)
+    {
+        return (aOffset == OFFSET)                                          ? 0
+             : (WireLayout<REST...>::wireOffset(aOffset) == WIRE_LAYOUT_NONE) ? WIRE_LAYOUT_NONE
+             :                                                                  1 + WireLayout<REST...>::wireOffset(aOffset);
+    }
+
+    /** Copy the object's bytes to the wire buffer.
+     */
+    static void encode(const uint8_t* aObject, uint8_t* aBuffer)
+    {
+        *aBuffer = aObject[OFFSET];
+        WireLayout<REST...>::encode(aObject, aBuffer + 1);
+    }
+
+    /** Copy the wire buffer's bytes to the object.
+     */
+    static void decode(uint8_t* aObject, const uint8_t* aBuffer)
+    {
+        aObject[OFFSET] = *aBuffer;
+        WireLayout<REST...>::decode(aObject, aBuffer + 1);
+    }
+};
 
 
 /** Class for handling i2c communications.
@@ -129,6 +320,18 @@ class I2cComms
 
     uint8_t gatewayId     = 0;          // Marks the presence of an I2C gateway module.
                                         // Certain messages are duplicated to this module.
+    uint8_t segment       = I2C_SEGMENT_NONE;   // The multiplexer segment currently selected.
+    uint8_t nodeId        = 0;          // Our own node ID, needed to restart Wire after a bus recovery.
+
+    uint16_t      recoveries        = 0;    // Number of bus recoveries performed.
+    unsigned long recoveryMicros    = 0L;   // Duration of the latest bus recovery.
+    unsigned long recoveryMicrosMax = 0L;   // Duration of the longest bus recovery.
+
+    WireTransport   wireTransport;                  // The I2C bus.
+#if COMMS_RS485
+    Rs485Transport  rs485Transport;                 // The RS-485 bus.
+#endif
+    CommsTransport* transport = &wireTransport;     // Transport of the current transfer.
 
     public:
 
@@ -147,8 +350,19 @@ class I2cComms
      */
     void setId(uint8_t aNodeId)
     {
-        Wire.begin(aNodeId);
-        Wire.setWireTimeout(I2C_TIMEOUT, true);     // Timeout (microseconds) if protocol hangs.
+        nodeId = aNodeId;
+
+#if COMMS_RS485
+        // Nodes answer on RS-485, the controller keeps I2C for its Inputs, multiplexers and LCD.
+        rs485Transport.begin(aNodeId);
+        transport = &rs485Transport;
+        if (aNodeId == I2C_CONTROLLER_ID)
+        {
+            wireTransport.begin(aNodeId);
+        }
+#else
+        wireTransport.begin(aNodeId);
+#endif
         
 //        TWBR = 158;                                 // Slow speed; 158=12.5kHz, 78=25kHz, 152=50kHz (prescaler=1).
 //        TWSR |= bit (TWPS0);                        // Prescaler = 4 for 12.5kHz & 25kHz. See http://www.gammon.com.au/i2c
@@ -159,7 +373,7 @@ class I2cComms
     */
     void onReceive(void (*aHandler)(int))
     {
-        Wire.onReceive(aHandler);
+        transport->onReceive(aHandler);
     }
 
 
@@ -167,16 +381,152 @@ class I2cComms
     */
     void onRequest(void (*aHandler)(void))
     {
-        Wire.onRequest(aHandler);
+        transport->onRequest(aHandler);
+    }
+
+
+    /** Process any messages for this node.
+     *  Call frequently from loop(). Only needed by RS-485 nodes, Wire uses interrupts.
+     */
+    void update()
+    {
+        transport->update();
+    }
+
+
+    /** Choose the transport for a node ID.
+     *  With RS-485, the Output modules and the Gateway are on RS-485 (there's no enumeration, see I2C_ENUM_ID).
+     *  Everything else stays on I2C.
+     */
+    CommsTransport* route(uint8_t aNodeId)
+    {
+#if COMMS_RS485
+        if (   (   (aNodeId >= I2C_OUTPUT_BASE_ID)
+                && (aNodeId <  I2C_OUTPUT_BASE_ID + I2C_OUTPUT_NODES))
+            || (   (I2C_GATEWAY_ID > 0)
+                && (aNodeId == I2C_GATEWAY_ID)))
+        {
+            return &rs485Transport;
+        }
+#endif
+
+        return &wireTransport;
     }
 
 
     /** Is a particular node ID connected to the I2C bus?
      */
-    bool exists(uint8_t aNodeId)
+    bool exists(uint16_t aNodeId)
+    {
+        return    (beginTransmission(aNodeId))
+               && (endTransmission() == 0);
+    }
+
+
+    /** Deselect all the segments of all the multiplexers.
+     */
+    void resetSegments()
+    {
+        for (uint8_t mux = 0; mux < I2C_MUX_MAX; mux++)
+        {
+            sendMux(mux, 0);
+        }
+
+        segment = I2C_SEGMENT_NONE;
+    }
+
+
+    /** Select a multiplexer segment.
+     *  Only talks to the multiplexer(s) if the segment isn't already selected.
+     *  Return true if the segment is selected (always true if there are no multiplexers).
+     */
+    bool selectSegment(uint8_t aSegment)
+    {
+        if (   (I2C_MUX_MAX > 0)
+            && (aSegment != segment))
+        {
+            uint8_t mux = aSegment >> I2C_MUX_SHIFT;
+
+            // Disconnect the multiplexer in use if the new segment is on a different one.
+            if (segment == I2C_SEGMENT_NONE)
+            {
+                resetSegments();
+            }
+            else if ((segment >> I2C_MUX_SHIFT) != mux)
+            {
+                sendMux(segment >> I2C_MUX_SHIFT, 0);
+            }
+
+            if (   (mux < I2C_MUX_MAX)
+                && (sendMux(mux, 1 << (aSegment & I2C_SEGMENT_MASK)) == 0))
+            {
+                segment = aSegment;
+            }
+            else
+            {
+                segment = I2C_SEGMENT_NONE;
+            }
+        }
+
+        return    (I2C_MUX_MAX == 0)
+               || (segment == aSegment);
+    }
+
+
+    /** Gets the segment a node is on.
+     */
+    uint8_t getSegment(uint8_t aNode)
+    {
+        return aNode >> I2C_SEGMENT_SHIFT;
+    }
+
+
+    /** Gets the bus ID of a device on a segment.
+     */
+    uint16_t segmentId(uint8_t aSegment, uint8_t aId)
+    {
+        return ((aSegment + 1) << 8) | aId;
+    }
+
+
+    /** Gets an Input node's bus ID.
+     */
+    uint16_t inputId(uint8_t aNode)
+    {
+        if (I2C_MUX_MAX > 0)
+        {
+            return segmentId(getSegment(aNode), I2C_INPUT_BASE_ID + (aNode & I2C_SEGMENT_MASK));
+        }
+
+        return I2C_INPUT_BASE_ID + aNode;
+    }
+
+
+    /** Gets the bus ID unassigned Output modules on a node's segment share.
+     */
+    uint16_t enumId(uint8_t aNode)
+    {
+        if (   (I2C_MUX_MAX > 0)
+            && (!COMMS_RS485))         // Output modules on RS-485 aren't behind the multiplexers.
+        {
+            return segmentId(getSegment(aNode), I2C_ENUM_ID);
+        }
+
+        return I2C_ENUM_ID;
+    }
+
+
+    /** Gets an Output node's bus ID.
+     */
+    uint16_t outputId(uint8_t aNode)
     {
-        beginTransmission(aNodeId);
-        return endTransmission() == 0;
+        if (   (I2C_MUX_MAX > 0)
+            && (!COMMS_RS485))         // Output modules on RS-485 aren't behind the multiplexers.
+        {
+            return segmentId(getSegment(aNode), I2C_OUTPUT_BASE_ID + (aNode & I2C_OUTPUT_ID_MASK));
+        }
+
+        return I2C_OUTPUT_BASE_ID + aNode;
     }
 
 
@@ -191,9 +541,12 @@ class I2cComms
 
     /** Send an I2C message with no data.
      */
-    uint8_t sendShort(uint8_t aNodeId, uint8_t aCommand)
+    uint8_t sendShort(uint16_t aNodeId, uint8_t aCommand)
     {
-        beginTransmission(aNodeId);
+        if (!beginTransmission(aNodeId))
+        {
+            return I2C_ERROR_SEGMENT;
+        }
         sendByte(aCommand);
         return endTransmission();
     }
@@ -201,9 +554,12 @@ class I2cComms
 
     /** Send an I2C message with data bytes.
      */
-    uint8_t sendData(uint8_t aNodeId, uint8_t aCommand, int aDataByte1, int aDataByte2)
+    uint8_t sendData(uint16_t aNodeId, uint8_t aCommand, int aDataByte1, int aDataByte2)
     {
-        beginTransmission(aNodeId);
+        if (!beginTransmission(aNodeId))
+        {
+            return I2C_ERROR_SEGMENT;
+        }
         sendByte(aCommand);
         if (aDataByte1 >= 0)
         {
@@ -228,11 +584,28 @@ class I2cComms
     }
 
 
+    /** Send a message with a buffer of data bytes to the Gateway (if there is one).
+     */
+    void sendGatewayBuffer(uint8_t aCommand, const uint8_t* aBuffer, uint8_t aLength)
+    {
+        if (gatewayId > 0)
+        {
+            beginTransmission(gatewayId);
+            sendByte(aCommand);
+            sendBuffer(aBuffer, aLength);
+            endTransmission();
+        }
+    }
+
+
     /** Send an I2C message with payload.
      */
-    uint8_t sendPayload(uint8_t aNodeId, uint8_t aCommand, void(* payload)())
+    uint8_t sendPayload(uint16_t aNodeId, uint8_t aCommand, void(* payload)())
     {
-        beginTransmission(aNodeId);
+        if (!beginTransmission(aNodeId))
+        {
+            return I2C_ERROR_SEGMENT;
+        }
         sendByte(aCommand);
         payload();
         return endTransmission();
@@ -244,25 +617,46 @@ class I2cComms
      */
     size_t sendByte(uint8_t aByte)
     {
-        return Wire.write(aByte);
+        return transport->write(aByte);
+    }
+
+
+    /** Send a buffer of bytes.
+     *  Use the Wire library to send them all with a single call.
+     */
+    size_t sendBuffer(const uint8_t* aBuffer, uint8_t aLength)
+    {
+        return transport->write(aBuffer, aLength);
     }
 
 
     /** Request a 1-byte response.
      *  Return the byte, or a negative number if failed.
+     *  Retry once if the failure was a stuck bus that's been recovered.
      */
-    int requestByte(uint8_t aNodeId)
+    int requestByte(uint16_t aNodeId)
     {
-        Wire.requestFrom(aNodeId, (uint8_t)1);
+        if (!selectBus(aNodeId))
+        {
+            return -1;
+        }
+
+        transport = route(lowByte(aNodeId));
 
-        return Wire.read();
+        if (   (transport->requestFrom(lowByte(aNodeId), (uint8_t)1) != 1)
+            && (checkBus()))
+        {
+            transport->requestFrom(lowByte(aNodeId), (uint8_t)1);
+        }
+
+        return transport->read();
     }
 
 
     /** Request a packet (of aLength).
      *  Return true if correct packet-length arrives, else false.
      */
-    bool requestPacket(uint8_t aNodeId, uint8_t aLength)
+    bool requestPacket(uint16_t aNodeId, uint8_t aLength)
     {
         // int len = Wire.requestFrom(aNodeId, aLength);
         // if (len != aLength)
@@ -285,18 +679,35 @@ class I2cComms
         // return    (len == aLength)
         //        && (avail == aLength);
 
-        return    (Wire.requestFrom(aNodeId, aLength) == aLength)
-               && (Wire.available() == aLength);
+        uint8_t len;
+
+        if (!selectBus(aNodeId))
+        {
+            return false;
+        }
+
+        transport = route(lowByte(aNodeId));
+        len       = transport->requestFrom(lowByte(aNodeId), aLength);
+
+        // Retry once if the failure was a stuck bus that's been recovered.
+        if (   (len != aLength)
+            && (checkBus()))
+        {
+            len = transport->requestFrom(lowByte(aNodeId), aLength);
+        }
+
+        return    (len == aLength)
+               && (transport->available() == aLength);
     }
 
 
-    /** Request a Gateway command.
-     *  Return true if command received.
+    /** Request a batch of Gateway commands.
+     *  Return true if the batch was received.
      */
     bool requestGateway()
     {
         return    (gatewayId > 0)
-               && (requestPacket(gatewayId, 2));
+               && (requestPacket(gatewayId, COMMS_GATEWAY_LEN));
     }
     
 
@@ -304,7 +715,7 @@ class I2cComms
      */
     int available()
     {
-        return Wire.available();
+        return transport->available();
     }
 
 
@@ -312,7 +723,27 @@ class I2cComms
      */
     int readByte()
     {
-        return Wire.read();
+        return transport->read();
+    }
+
+
+    /** Reads a buffer of bytes from the receive buffer.
+     */
+    void readBuffer(uint8_t* aBuffer, uint8_t aLength)
+    {
+        while (aLength-- > 0)
+        {
+            *aBuffer++ = transport->read();
+        }
+    }
+
+
+    /** Add bytes to a running checksum.
+     *  See commsChecksum().
+     */
+    static uint8_t checksum(uint8_t aChecksum, const uint8_t* aBuffer, uint8_t aLength)
+    {
+        return commsChecksum(aChecksum, aBuffer, aLength);
     }
 
 
@@ -320,44 +751,185 @@ class I2cComms
      */
     int readWord()
     {
-        return   (Wire.read() & 0xff)
-               | (Wire.read() << 8);
+        int lo = transport->read() & 0xff;
+
+        return lo | (transport->read() << 8);
 
     }
 
 
+    /** Check the bus after a failed transfer.
+     *  If the Wire timeout fired, or a slave is holding SDA low, recover the bus.
+     *  SDA is also low while another master (the gateway ringing its doorbell) is sending,
+     *  so it's only stuck if it stays low for longer than any transfer could take.
+     *  Return true if the bus was recovered.
+     */
+    bool checkBus()
+    {
+        if (transport != &wireTransport)
+        {
+            return false;               // Only I2C has a bus to recover.
+        }
+
+        if (!Wire.getWireTimeoutFlag())
+        {
+            unsigned long start = micros();
+
+            while (digitalRead(SDA) == LOW)
+            {
+                if (micros() - start > I2C_STUCK_MICROS)
+                {
+                    break;
+                }
+            }
+
+            if (digitalRead(SDA) == HIGH)
+            {
+                return false;           // Bus is free.
+            }
+        }
+
+        recoverBus();
+        return true;
+    }
+
+
+    /** Recover a bus held by a slave that was reset mid-transfer.
+     *  Resetting the TWI hardware doesn't free the slave, so take the pins from Wire,
+     *  clock SCL until the slave releases SDA, issue a STOP and restart Wire.
+     *  Pins are driven open-drain: OUTPUT (port bit low) pulls the line low, INPUT lets it float high.
+     */
+    void recoverBus()
+    {
+        unsigned long start = micros();
+
+        Wire.end();
+        pinMode(SDA, INPUT);
+        pinMode(SCL, INPUT);
+        delayMicroseconds(I2C_RECOVERY_DELAY);
+
+        // Clock SCL until the slave finishes its byte and releases SDA.
+        for (uint8_t clock = 0; (clock < I2C_RECOVERY_CLOCKS) && (digitalRead(SDA) == LOW); clock++)
+        {
+            pinMode(SCL, OUTPUT);
+            delayMicroseconds(I2C_RECOVERY_DELAY);
+            pinMode(SCL, INPUT);
+            delayMicroseconds(I2C_RECOVERY_DELAY);
+        }
+
+        // STOP: SDA rises while SCL is high.
+        pinMode(SCL, OUTPUT);
+        pinMode(SDA, OUTPUT);
+        delayMicroseconds(I2C_RECOVERY_DELAY);
+        pinMode(SCL, INPUT);
+        delayMicroseconds(I2C_RECOVERY_DELAY);
+        pinMode(SDA, INPUT);
+        delayMicroseconds(I2C_RECOVERY_DELAY);
+
+        // Restart Wire, the multiplexers will need re-selecting.
+        wireTransport.begin(nodeId);
+        Wire.clearWireTimeoutFlag();
+        segment = I2C_SEGMENT_NONE;
+
+        recoveries    += 1;
+        recoveryMicros = micros() - start;
+        if (recoveryMicros > recoveryMicrosMax)
+        {
+            recoveryMicrosMax = recoveryMicros;
+        }
+    }
+
+
+    /** Gets the number of bus recoveries performed.
+     */
+    uint16_t getRecoveries()
+    {
+        return recoveries;
+    }
+
+
+    /** Gets the duration (microseconds) of the latest bus recovery.
+     */
+    unsigned long getRecoveryMicros()
+    {
+        return recoveryMicros;
+    }
+
+
+    /** Gets the duration (microseconds) of the longest bus recovery.
+     */
+    unsigned long getRecoveryMicrosMax()
+    {
+        return recoveryMicrosMax;
+    }
+
+
     /** Ignore all received data that's left in the receive buffer.
      */
     void readAll()
     {
-        while (Wire.available())
+        while (transport->available())
         {
-            Wire.read();
+            transport->read();
         }
     }
 
 
     private:
 
+    /** Send a channel selection to a multiplexer.
+     *  Bit n of aChannels connects channel n.
+     */
+    uint8_t sendMux(uint8_t aMux, uint8_t aChannels)
+    {
+        beginTransmission(I2C_MUX_BASE_ID + aMux);
+        sendByte(aChannels);
+        return endTransmission();
+    }
+
+
 //    long start;
 //    long send;
 //    long sent;
     
+    /** Select a bus ID's segment, if it has one.
+     *  Return true if the node can be addressed.
+     */
+    bool selectBus(uint16_t aNodeId)
+    {
+        return    (highByte(aNodeId) == 0)
+               || (selectSegment(highByte(aNodeId) - 1));
+    }
+
+
     /** Begin transmission to a particular node.
+     *  Return false (and don't begin) if the node's segment couldn't be selected.
      */    
-    void beginTransmission(uint8_t aNodeId)
+    bool beginTransmission(uint16_t aNodeId)
     {
 //        start = micros();
-        Wire.beginTransmission(aNodeId);
+        if (!selectBus(aNodeId))
+        {
+            return false;
+        }
+
+        transport = route(lowByte(aNodeId));
+        transport->beginTransmission(lowByte(aNodeId));
+        return true;
     }
 
     
     /** End transmission to current node.
+     *  Recover the bus if the failure was caused by a stuck bus.
      */    
     uint8_t endTransmission()
     {
 //        send = micros();
-        uint8_t ret = Wire.endTransmission();
+        uint8_t ret = transport->endTransmission();
+        if (ret != 0)
+        {
+            checkBus();
+        }
 //        sent = micros();
 //
 //        Serial.print(send - start);
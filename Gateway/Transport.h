@@ -0,0 +1,442 @@
+/** Transports for the controller/module messages.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021    tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  I2cComms defines the messages, a transport carries them between nodes.
+ *  Every transport follows the Wire model: a master transmits to, or requests from, a node ID,
+ *  and nodes answer through receive and request handlers.
+ *
+ *  WireTransport   The I2C bus, using the Wire library.
+ *  Rs485Transport  A multidrop RS-485 bus on a UART (if COMMS_RS485). For long runs to the Output modules and Gateway.
+ *                  The controller and Gateway use a SoftwareSerial, an OutputModule its Serial (see RS485_SERIAL).
+ *                  Input nodes (MCP23017s), multiplexers and the LCD always stay on I2C.
+ *
+ *
+ *  RS-485 frames:
+ *
+ *      <Sync> <Node> <TypeLen> <Payload>... <Checksum>
+ *
+ *      Sync        RS485_SYNC, marks the start of a frame.
+ *      Node        The node ID the frame is addressed to (the same IDs as I2C). Replies are addressed to I2C_CONTROLLER_ID.
+ *      TypeLen     Frame type (RS485_TYPE_...) in the top 2 bits, payload length (0-32) in the bottom 6 bits.
+ *      Payload     WRITE: the message.
+ *                  READ:  one byte, the number of bytes requested.
+ *                  ACK:   nothing.
+ *                  DATA:  the node's response.
+ *      Checksum    Running checksum (see commsChecksum()) of Node, TypeLen and Payload.
+ *
+ *  The master sends a WRITE and the node answers with an ACK once its receive handler has run,
+ *  or the master sends a READ and the node answers with a DATA frame from its request handler.
+ *  A node waits RS485_TURNAROUND before driving the bus, giving the master time to release it.
+ *  A missing or corrupt reply fails the transfer, just as an I2C NACK would.
+ */
+
+#ifndef Transport_h
+#define Transport_h
+
+
+#include <Wire.h>
+
+
+/** Add bytes to a running checksum.
+ *  The sum is rotated before each byte so that misordered bytes are detected too.
+ */
+uint8_t commsChecksum(uint8_t aChecksum, const uint8_t* aBuffer, uint8_t aLength)
+{
+    while (aLength-- > 0)
+    {
+        aChecksum = ((aChecksum << 1) | (aChecksum >> 7)) + *aBuffer++;
+    }
+
+    return aChecksum;
+}
+
+
+/** The Wire model of a transport.
+ */
+class CommsTransport
+{
+    public:
+
+    virtual void    begin(uint8_t aNodeId) = 0;
+    virtual void    onReceive(void (*aHandler)(int)) = 0;
+    virtual void    onRequest(void (*aHandler)(void)) = 0;
+    virtual void    update() = 0;
+
+    virtual void    beginTransmission(uint8_t aNodeId) = 0;
+    virtual size_t  write(uint8_t aByte) = 0;
+    virtual size_t  write(const uint8_t* aBuffer, uint8_t aLength) = 0;
+    virtual uint8_t endTransmission() = 0;
+    virtual uint8_t requestFrom(uint8_t aNodeId, uint8_t aLength) = 0;
+
+    virtual int     available() = 0;
+    virtual int     read() = 0;
+};
+
+
+/** The I2C bus.
+ */
+class WireTransport: public CommsTransport
+{
+    public:
+
+    void begin(uint8_t aNodeId)
+    {
+        Wire.begin(aNodeId);
+        Wire.setWireTimeout(I2C_TIMEOUT, true);     // Timeout (microseconds) if protocol hangs.
+    }
+
+    void onReceive(void (*aHandler)(int))
+    {
+        Wire.onReceive(aHandler);
+    }
+
+    void onRequest(void (*aHandler)(void))
+    {
+        Wire.onRequest(aHandler);
+    }
+
+    /** Nothing to do, Wire calls the handlers from its interrupt.
+     */
+    void update()
+    {
+    }
+
+    void beginTransmission(uint8_t aNodeId)
+    {
+        Wire.beginTransmission(aNodeId);
+    }
+
+    size_t write(uint8_t aByte)
+    {
+        return Wire.write(aByte);
+    }
+
+    size_t write(const uint8_t* aBuffer, uint8_t aLength)
+    {
+        return Wire.write(aBuffer, aLength);
+    }
+
+    uint8_t endTransmission()
+    {
+        return Wire.endTransmission();
+    }
+
+    uint8_t requestFrom(uint8_t aNodeId, uint8_t aLength)
+    {
+        return Wire.requestFrom(aNodeId, aLength);
+    }
+
+    int available()
+    {
+        return Wire.available();
+    }
+
+    int read()
+    {
+        return Wire.read();
+    }
+};
+
+
+#if COMMS_RS485
+
+#if RS485_SOFTWARE
+#include <SoftwareSerial.h>
+
+SoftwareSerial rs485Serial(RS485_RX_PIN, RS485_TX_PIN);     // The bus's UART, see RS485_SERIAL.
+#endif
+
+// RS-485 framing.
+const uint8_t RS485_SYNC            = 0xA5;     // Start of frame.
+const uint8_t RS485_TYPE_WRITE      = 0x00;     // Master sends a message.
+const uint8_t RS485_TYPE_READ       = 0x40;     // Master requests a response.
+const uint8_t RS485_TYPE_ACK        = 0x80;     // Node acknowledges a message.
+const uint8_t RS485_TYPE_DATA       = 0xC0;     // Node's response.
+const uint8_t RS485_TYPE_MASK       = 0xC0;     // Frame type bits.
+const uint8_t RS485_LEN_MASK        = 0x3F;     // Payload length bits.
+const uint8_t RS485_HEADER_LEN      =    2;     // Node and TypeLen.
+const uint8_t RS485_FRAME_MAX       = RS485_HEADER_LEN + BUFFER_LENGTH;     // Longest frame (less sync and checksum).
+
+// Transfer results, as returned by Wire.endTransmission().
+const uint8_t RS485_OK              =    0;     // Acknowledged.
+const uint8_t RS485_TOO_LONG        =    1;     // Message too long for the buffer.
+const uint8_t RS485_NO_REPLY        =    2;     // No (valid) acknowledgement from the node.
+
+
+/** A multidrop RS-485 bus on a UART.
+ *  The transceiver's driver-enable (and receive-enable) pins are driven by RS485_DE_PIN.
+ */
+class Rs485Transport: public CommsTransport
+{
+    private:
+
+    uint8_t nodeId     = 0;                 // Our node ID.
+    bool    started    = false;             // UART started.
+
+    uint8_t txId       = 0;                 // Node being transmitted to.
+    uint8_t txBuffer[BUFFER_LENGTH];        // Message being built (master) or response (node).
+    uint8_t txLen      = 0;
+
+    uint8_t rxBuffer[BUFFER_LENGTH];        // Message received (node) or response received (master).
+    uint8_t rxLen      = 0;
+    uint8_t rxIndex    = 0;
+
+    uint8_t frame[RS485_FRAME_MAX];         // Frame being parsed (Node, TypeLen and Payload).
+    uint8_t frameLen   = 0;
+    bool    framing    = false;             // Sync seen, frame being collected.
+    uint8_t checksum   = 0;                 // Checksum of the frame so far.
+
+    void (*receiveHandler)(int)  = NULL;
+    void (*requestHandler)(void) = NULL;
+
+
+    /** Send a frame, driving the bus only while it's sent.
+     */
+    void sendFrame(uint8_t aNodeId, uint8_t aType, const uint8_t* aPayload, uint8_t aLength)
+    {
+        uint8_t header[RS485_HEADER_LEN] = { aNodeId, (uint8_t)(aType | aLength) };
+        uint8_t sum = commsChecksum(commsChecksum(0, header, RS485_HEADER_LEN), aPayload, aLength);
+
+        digitalWrite(RS485_DE_PIN, HIGH);
+        RS485_SERIAL.write(RS485_SYNC);
+        RS485_SERIAL.write(header, RS485_HEADER_LEN);
+        RS485_SERIAL.write(aPayload, aLength);
+        RS485_SERIAL.write(sum);
+        RS485_SERIAL.flush();                   // Wait for the last byte to leave the UART.
+        digitalWrite(RS485_DE_PIN, LOW);
+    }
+
+
+    /** Parse received bytes.
+     *  Return true when a whole, valid frame has been received.
+     */
+    bool parseFrame()
+    {
+        while (RS485_SERIAL.available() > 0)
+        {
+            uint8_t ch = RS485_SERIAL.read();
+
+            if (!framing)
+            {
+                framing  = ch == RS485_SYNC;
+                frameLen = 0;
+                checksum = 0;
+            }
+            else if (   (frameLen >= RS485_HEADER_LEN)
+                     && (frameLen == RS485_HEADER_LEN + (frame[1] & RS485_LEN_MASK)))
+            {
+                // Frame complete, ch is its checksum.
+                framing = false;
+                if (ch == checksum)
+                {
+                    return true;
+                }
+            }
+            else if (   (frameLen == 1)
+                     && ((ch & RS485_LEN_MASK) > BUFFER_LENGTH))
+            {
+                framing = false;                // Can't be a valid frame, hunt for the next sync.
+            }
+            else
+            {
+                frame[frameLen++] = ch;
+                checksum = commsChecksum(checksum, &ch, 1);
+            }
+        }
+
+        return false;
+    }
+
+
+    /** Wait for the reply to a master's frame.
+     *  Return true if a reply of the given type (addressed to us) arrived in time.
+     */
+    bool awaitReply(uint8_t aType)
+    {
+        unsigned long start = micros();
+
+        framing = false;
+        while (micros() - start < RS485_TIMEOUT)
+        {
+            if (   (parseFrame())
+                && (frame[0] == nodeId)
+                && ((frame[1] & RS485_TYPE_MASK) == aType))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+    public:
+
+    /** Start the bus as a particular node.
+     *  Can be called again (e.g. when a node is renumbered) to change the node's ID.
+     */
+    void begin(uint8_t aNodeId)
+    {
+        nodeId = aNodeId;
+
+        if (!started)
+        {
+            started = true;
+            pinMode(RS485_DE_PIN, OUTPUT);
+            digitalWrite(RS485_DE_PIN, LOW);    // Listen.
+            RS485_SERIAL.begin(RS485_SPEED);
+        }
+    }
+
+    void onReceive(void (*aHandler)(int))
+    {
+        receiveHandler = aHandler;
+    }
+
+    void onRequest(void (*aHandler)(void))
+    {
+        requestHandler = aHandler;
+    }
+
+
+    /** Process frames addressed to this node.
+     *  Must be called frequently by nodes (not required by the master).
+     *  Calls the receive or request handler (outside interrupts, unlike Wire), then replies.
+     */
+    void update()
+    {
+        if (   (parseFrame())
+            && (frame[0] == nodeId))
+        {
+            uint8_t type = frame[1] & RS485_TYPE_MASK;
+            uint8_t len  = frame[1] & RS485_LEN_MASK;
+
+            if (type == RS485_TYPE_WRITE)
+            {
+                memcpy(rxBuffer, frame + RS485_HEADER_LEN, len);
+                rxLen   = len;
+                rxIndex = 0;
+
+                if (receiveHandler != NULL)
+                {
+                    receiveHandler(len);
+                }
+
+                delayMicroseconds(RS485_TURNAROUND);
+                sendFrame(I2C_CONTROLLER_ID, RS485_TYPE_ACK, NULL, 0);
+            }
+            else if (type == RS485_TYPE_READ)
+            {
+                txLen = 0;
+                if (requestHandler != NULL)
+                {
+                    requestHandler();
+                }
+
+                // Send no more than was asked for.
+                if (   (len > 0)
+                    && (txLen > frame[RS485_HEADER_LEN]))
+                {
+                    txLen = frame[RS485_HEADER_LEN];
+                }
+
+                delayMicroseconds(RS485_TURNAROUND);
+                sendFrame(I2C_CONTROLLER_ID, RS485_TYPE_DATA, txBuffer, txLen);
+            }
+        }
+    }
+
+
+    void beginTransmission(uint8_t aNodeId)
+    {
+        txId  = aNodeId;
+        txLen = 0;
+    }
+
+
+    size_t write(uint8_t aByte)
+    {
+        if (txLen < BUFFER_LENGTH)
+        {
+            txBuffer[txLen++] = aByte;
+            return 1;
+        }
+
+        return 0;
+    }
+
+
+    size_t write(const uint8_t* aBuffer, uint8_t aLength)
+    {
+        size_t count = 0;
+
+        while (   (aLength-- > 0)
+               && (write(*aBuffer++) > 0))
+        {
+            count += 1;
+        }
+
+        return count;
+    }
+
+
+    /** Send the message and wait for the node's acknowledgement.
+     */
+    uint8_t endTransmission()
+    {
+        sendFrame(txId, RS485_TYPE_WRITE, txBuffer, txLen);
+
+        return awaitReply(RS485_TYPE_ACK) ? RS485_OK : RS485_NO_REPLY;
+    }
+
+
+    /** Request a response from a node.
+     *  Return the number of bytes received.
+     */
+    uint8_t requestFrom(uint8_t aNodeId, uint8_t aLength)
+    {
+        rxLen   = 0;
+        rxIndex = 0;
+
+        if (aLength > BUFFER_LENGTH)
+        {
+            aLength = BUFFER_LENGTH;
+        }
+
+        sendFrame(aNodeId, RS485_TYPE_READ, &aLength, 1);
+
+        if (awaitReply(RS485_TYPE_DATA))
+        {
+            rxLen = min(frame[1] & RS485_LEN_MASK, aLength);
+            memcpy(rxBuffer, frame + RS485_HEADER_LEN, rxLen);
+        }
+
+        return rxLen;
+    }
+
+
+    int available()
+    {
+        return rxLen - rxIndex;
+    }
+
+
+    int read()
+    {
+        return rxIndex < rxLen ? rxBuffer[rxIndex++] : -1;
+    }
+};
+
+#endif
+
+
+#endif
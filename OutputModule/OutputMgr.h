@@ -29,7 +29,7 @@ class OutputMgr: public Persisted
      */
     OutputMgr(uint16_t aBase) : Persisted(aBase)
     {
-        size = OUTPUT_NODE_MAX * sizeof(OutputDef);
+        size = OUTPUT_PIN_MAX * sizeof(OutputDef);
     }
 
 
@@ -126,6 +126,11 @@ volatile uint8_t requestCommand = COMMS_CMD_NONE;
 volatile uint8_t requestOption  = 0;
 volatile uint8_t requestNode    = 0;
 
+// Enumeration.
+bool             enumCandidate  = false;    // Still a candidate in the current enumeration pass.
+volatile bool    enumPick       = false;    // Pick a new unique ID, see loop().
+bool             enumCheck      = false;    // Answer the CHECK step.
+
 
 // An Array of Output control structures.
 struct
@@ -177,8 +182,16 @@ void setup()
         }
     }
 
-    // Start I2C communications.
-    i2cComms.setId(systemMgr.getModuleId(true));
+    // Enumeration needs I2C (see COMMS_ENUM_START), so on RS-485 an unassigned module goes back to its jumpers.
+    if (   (COMMS_RS485)
+        && (systemMgr.isUnassigned()))
+    {
+        systemMgr.setModuleId(SYS_MODULE_ID_JUMPERS);
+        systemMgr.saveSystemData();
+    }
+
+    // Start I2C communications, at the shared enumeration ID if we're waiting for a module ID.
+    i2cComms.setId(systemMgr.isUnassigned() ? I2C_ENUM_ID : systemMgr.getModuleId(true));
     i2cComms.onReceive(processReceipt);
     i2cComms.onRequest(processRequest);
 
@@ -222,6 +235,14 @@ void firstRun()
         outputMgr.saveOutput(pin);
     }
 
+    // Without jumpers, wait for the controller to assign a module ID (only on I2C).
+    if (   (I2C_ENUM_ID > 0)
+        && (!COMMS_RS485)
+        && (!systemMgr.hasJumpers()))
+    {
+        systemMgr.setModuleId(SYS_MODULE_ID_UNASSIGNED);
+    }
+
     systemMgr.saveSystemData();
 }
 
@@ -430,12 +451,19 @@ void processRequest()
         case COMMS_CMD_READ:   returnDef();
                                break;
 
+        case COMMS_CMD_READ_ALL: returnPage();
+                               break;
+
         default:               unrecognisedCommand(M_DEBUG_REQUEST, requestCommand, requestOption);
                                break;
     }
 
-    // Clear pending command.
-    requestCommand = COMMS_CMD_NONE;
+    // Clear pending command, unless a bulk read has more pages to send.
+    if (   (requestCommand != COMMS_CMD_READ_ALL)
+        || (requestOption  >= OUTPUT_PAGE_MAX))
+    {
+        requestCommand = COMMS_CMD_NONE;
+    }
 }
 
 
@@ -451,6 +479,9 @@ void returnSystem()
         case COMMS_SYS_RENUMBER:   returnRenumber();
                                    break;
 
+        case COMMS_SYS_ENUMERATE:  returnEnumerate();
+                                   break;
+
         default:                   unrecognisedCommand(M_DEBUG_SYSTEM, requestCommand, requestOption);
                                    break;
     }
@@ -498,6 +529,31 @@ void returnRenumber()
 }
 
 
+/** Return an enumeration vote (or check).
+ *  If we've been assigned a module ID, change to it.
+ */
+void returnEnumerate()
+{
+    if (enumCheck)
+    {
+        i2cComms.sendByte(systemMgr.getUniqueCheck());
+        i2cComms.sendByte(~systemMgr.getUniqueCheck());
+        enumCheck = false;
+    }
+    else
+    {
+        i2cComms.sendByte(requestNode);
+    }
+
+    if (   (enumCandidate)
+        && (!systemMgr.isUnassigned()))
+    {
+        enumCandidate = false;
+        i2cComms.setId(systemMgr.getModuleId(true));
+    }
+}
+
+
 /** Return the requested pin's Output definition.
  */
 void returnDef()
@@ -510,6 +566,44 @@ void returnDef()
 }
 
 
+/** Return the requested page of Output definitions, followed by the running checksum.
+ *  The checksum covers every definition from pin 0, so the master can spot a lost or repeated page.
+ *  Then move on to the next page, ready for the master's next request.
+ */
+void returnPage()
+{
+    uint8_t checksum = 0;
+    uint8_t pin      = 0;
+
+    if (requestOption >= OUTPUT_PAGE_MAX)
+    {
+        unrecognisedCommand(M_DEBUG_REQUEST, requestCommand, requestOption);
+        return;
+    }
+
+    if (isDebug(DEBUG_BRIEF))
+    {
+        Serial.print(PGMT(M_DEBUG_READ_ALL));
+        Serial.print(PGMT(M_DEBUG_START));
+        Serial.print(requestOption * OUTPUT_PAGE_DEFS);
+        Serial.println();
+    }
+
+    for ( ; pin < requestOption * OUTPUT_PAGE_DEFS; pin++)
+    {
+        checksum = outputDefs[pin].checksum(checksum);
+    }
+
+    for ( ; pin < (requestOption + 1) * OUTPUT_PAGE_DEFS; pin++)
+    {
+        checksum = outputDefs[pin].write(checksum);
+    }
+
+    i2cComms.sendByte(checksum);
+    requestOption += 1;
+}
+
+
 /** Data received.
  *  Process the command.
  */
@@ -558,9 +652,16 @@ void processReceipt(int aLen)
                                    requestOption  = option;             // and the pin the master wants to read.
                                    break;
 
+            case COMMS_CMD_READ_ALL: requestCommand = command;          // Record the command.
+                                   requestOption  = option;             // and the first page the master wants to read.
+                                   break;
+
             case COMMS_CMD_WRITE:  processWrite(pin);                   // Process the Output's data.
                                    break;
 
+            case COMMS_CMD_WRITE_FIELDS: processWriteFields(pin);       // Process some of the Output's data.
+                                   break;
+
             case COMMS_CMD_SAVE:   processSave(pin);                    // Save the Output's data.
                                    break;
 
@@ -639,6 +740,9 @@ void processSystem(uint8_t aOption)
         case COMMS_SYS_MOVE_LOCKS: processMoveLocks();
                                    break;
 
+        case COMMS_SYS_ENUMERATE:  processEnumerate();
+                                   break;
+
         default:                   unrecognisedCommand(M_DEBUG_SYSTEM, COMMS_CMD_SYSTEM, aOption);
                                    break;
     }
@@ -675,6 +779,73 @@ void processRenumber()
 }
 
 
+/** Process an enumeration step.
+ *  Every unassigned module receives each step, so votes from non-candidates must be neutral (COMMS_ENUM_NONE).
+ */
+void processEnumerate()
+{
+    uint8_t step = i2cComms.readByte();
+    uint8_t arg  = i2cComms.readByte();
+    bool    one  = (systemMgr.getUniqueId() >> (arg & (COMMS_ENUM_BITS - 1))) & 1;
+
+    requestNode = COMMS_ENUM_NONE;
+
+    switch (step)
+    {
+        case COMMS_ENUM_START:  enumCandidate = systemMgr.isUnassigned();
+                                enumPick      = enumCandidate;
+                                break;
+
+        case COMMS_ENUM_VOTE:   requestCommand = COMMS_CMD_SYSTEM;
+                                requestOption  = COMMS_SYS_ENUMERATE;
+                                if (   (enumCandidate)
+                                    && (!one))
+                                {
+                                    requestNode = COMMS_ENUM_ZERO;
+                                }
+                                break;
+
+        case COMMS_ENUM_DROP:   if (one)
+                                {
+                                    enumCandidate = false;
+                                }
+                                break;
+
+        case COMMS_ENUM_ASSIGN: requestCommand = COMMS_CMD_SYSTEM;
+                                requestOption  = COMMS_SYS_ENUMERATE;
+                                if (enumCandidate)
+                                {
+                                    requestNode = arg;
+                                    systemMgr.setModuleId(arg);
+                                    systemMgr.saveSystemData();
+
+                                    if (isDebug(DEBUG_BRIEF))
+                                    {
+                                        Serial.print(PGMT(M_DEBUG_ASSIGN));
+                                        Serial.print(PGMT(M_DEBUG_NODE));
+                                        Serial.print(arg, HEX);
+                                        Serial.println();
+                                    }
+                                }
+                                break;
+
+        case COMMS_ENUM_CHECK:  requestCommand = COMMS_CMD_SYSTEM;
+                                requestOption  = COMMS_SYS_ENUMERATE;
+                                enumCheck      = true;
+                                break;
+
+        case COMMS_ENUM_RELEASE:
+                                systemMgr.setModuleId(SYS_MODULE_ID_UNASSIGNED);
+                                systemMgr.saveSystemData();
+                                i2cComms.setId(I2C_ENUM_ID);
+                                break;
+
+        default:                unrecognisedCommand(M_DEBUG_SYSTEM, COMMS_CMD_SYSTEM, COMMS_SYS_ENUMERATE);
+                                break;
+    }
+}
+
+
 /** Process a move locks request
  */
 void processMoveLocks()
@@ -747,7 +918,7 @@ void processMoveLocks()
  */
 void processWrite(uint8_t aPin)
 {
-    if (i2cComms.available() < ((int)sizeof(OutputDef)))
+    if (i2cComms.available() < OUTPUT_DEF_LEN)
     {
         if (isDebug(DEBUG_ERRORS))
         {
@@ -773,6 +944,48 @@ void processWrite(uint8_t aPin)
 }
 
 
+/** Process a write of some of an Output's fields.
+ *  A mask of the fields, then the fields themselves.
+ */
+void processWriteFields(uint8_t aPin)
+{
+    uint8_t mask = 0;
+    bool    ok   = false;
+
+    if (i2cComms.available() > 0)
+    {
+        mask = i2cComms.readByte();
+        ok   = i2cComms.available() >= OutputDef::fieldsLen(mask);
+    }
+
+    if (!ok)
+    {
+        if (isDebug(DEBUG_ERRORS))
+        {
+            Serial.print(PGMT(M_DEBUG_WRITE_FIELDS));
+            Serial.print(aPin, HEX);
+            Serial.print(PGMT(M_DEBUG_FIELDS));
+            Serial.print(mask, HEX);
+            Serial.print(PGMT(M_DEBUG_LEN));
+            Serial.print(i2cComms.available(), HEX);
+            Serial.println();
+        }
+    }
+    else
+    {
+        persisting = false;                     // Stop saving state to EEPROM.
+        outputDefs[aPin].readFields(mask);      // Read the changed fields of the Output definition.
+
+        if (isDebug(DEBUG_BRIEF))
+        {
+            outputDefs[aPin].printDef(M_DEBUG_WRITE_FIELDS, systemMgr.getModuleId(false), aPin);
+        }
+
+        initOutput(aPin);                       // Initialise the pin.
+    }
+}
+
+
 /** Process a save command.
  */
 void processSave(uint8_t aPin)
@@ -1159,8 +1372,8 @@ void processCommand()
     // Expect three characters, command, nodeOld, nodeNew
     if (strlen(commandBuffer) == 3)
     {
-        nodeOld = charToHex(commandBuffer[1]);
-        nodeNew = charToHex(commandBuffer[2]);
+        nodeOld = charToNode(commandBuffer[1]);
+        nodeNew = charToNode(commandBuffer[2]);
 
         switch (commandBuffer[0] | 0x20)            // Command character converted to lower-case.
         {
@@ -1672,8 +1885,13 @@ void stepFlash(uint8_t aPin)
  */
 void loop()
 {
-    // Look for command characters
-    while (Serial.available() > 0)
+    // Process messages from an RS-485 bus (Wire uses interrupts).
+    i2cComms.update();
+
+    // Look for command characters (unless the serial port is the RS-485 bus).
+    while (   (   (!COMMS_RS485)
+               || (RS485_SOFTWARE))
+           && (Serial.available() > 0))
     {
         char ch = Serial.read();
         if (ch == CHAR_RETURN)
@@ -1696,6 +1914,13 @@ void loop()
         }
     }
 
+    // Pick a new unique ID for enumeration (too slow for the receive handler).
+    if (enumPick)
+    {
+        systemMgr.newUniqueId();
+        enumPick = false;
+    }
+
     // Record the time now
     now = millis();
 
@@ -47,7 +47,10 @@ class Buttons
     {
         for (uint8_t button = BUTTON_LOW; button <= BUTTON_HIGH; button++)
         {
-            pinMode(BUTTON_PINS[button], INPUT_PULLUP);
+            if (BUTTON_PINS[button] != 0xff)
+            {
+                pinMode(BUTTON_PINS[button], INPUT_PULLUP);
+            }
         }
     }
 
@@ -187,7 +190,8 @@ class Buttons
             // Scan alternate buttons.
             for (button = BUTTON_HIGH; button >= BUTTON_LOW; button--)
             {
-                if (!digitalRead(BUTTON_PINS[button]))
+                if (   (BUTTON_PINS[button] != 0xff)
+                    && (!digitalRead(BUTTON_PINS[button])))
                 {
                     break;
                 }
@@ -37,6 +37,72 @@ const uint8_t TYPE_RECEIVE  = 'R';
 const uint8_t TYPE_TRANSMIT = 'T';
 const uint8_t TYPE_ERROR    = 'E';
 
+// CMRI node types (from an INIT message).
+const uint8_t NODE_SMINI    = 'M';         // SMINI, 3 input bytes and 6 output bytes.
+const uint8_t NODE_USIC     = 'N';         // USIC/SUSIC with 24-bit cards, described by card type bytes.
+const uint8_t NODE_SUSIC    = 'X';         // SUSIC with 32-bit cards, described by card type bytes.
+
+const uint8_t SMINI_INPUT_BYTES  = 3;
+const uint8_t SMINI_OUTPUT_BYTES = 6;
+const uint8_t USIC_CARD_BYTES    = 3;
+const uint8_t SUSIC_CARD_BYTES   = 4;
+const uint8_t CARD_TYPE_INPUT    = 1;      // Card type (2 bits per card, 4 cards per card type byte).
+const uint8_t CARD_TYPE_OUTPUT   = 2;
+const uint8_t CARD_TYPE_MASK     = 3;
+const uint8_t CARDS_PER_TYPE     = 4;
+const uint8_t INIT_CARD_TYPES    = 4;      // Offset of the card type bytes in an INIT message.
+
+// Poll reply.
+const uint8_t CMRI_HEADER_LEN   = 5;                                                // SYN, SYN, STX, address and type.
+const uint8_t CMRI_ADDR_OFFSET  = 3;                                                // Offset of the address in the header.
+const uint8_t CMRI_STATES_LEN   = INPUT_NODE_MAX * 2 + OUTPUT_NODE_MAX;             // Input states (2 bytes per node), then Output states.
+const uint8_t CMRI_REPLY_MAX    = CMRI_HEADER_LEN + CMRI_STATES_LEN * 2 + 1;        // Every state escaped, then ETX.
+
+#if SERIAL_FRAMED
+static_assert(MUX_CMRI_LEN >= CMRI_REPLY_MAX, "An escaped CMRI TRANSMIT doesn't fit the CMRI channel");
+#endif
+
+
+/** A CMRI node (address) answered by this controller.
+ *  Its states are the given Input nodes (2 bytes each), then the given Output nodes (1 byte each).
+ */
+struct CmriNode
+{
+    uint8_t address;            // CMRI address (JMRI node address + 'A'), or CMRI_ADDR_ANY.
+    uint8_t firstInput;         // First Input node.
+    uint8_t inputs;             // Number of Input nodes.
+    uint8_t firstOutput;        // First Output node.
+    uint8_t outputs;            // Number of Output nodes.
+};
+
+const uint8_t CMRI_ADDR_ANY  = 0;                   // Answer any address.
+const uint8_t CMRI_NODE_NONE = 0xff;                // Address not answered.
+
+/** The CMRI nodes, checked in order.
+ *  Split the layout across several addresses so JMRI can poll busy areas more often than quiet ones, eg:
+ *      { 'A', 0, 2, 0,  8 },
+ *      { 'B', 2, 6, 8, 24 },
+ */
+constexpr CmriNode CMRI_NODES[] =
+{
+//    Address        First Input  Inputs          First Output  Outputs
+    { CMRI_ADDR_ANY, 0,           INPUT_NODE_MAX, 0,            OUTPUT_NODE_MAX }
+};
+
+const uint8_t CMRI_NODE_COUNT = sizeof(CMRI_NODES) / sizeof(CMRI_NODES[0]);
+
+
+/** Offset of a CMRI node's poll reply among them all.
+ *  Each node has room for its own states escaped, as well as the header and ETX.
+ */
+constexpr uint16_t cmriReplyOffset(uint8_t aNode)
+{
+    return (aNode == 0) ? 0
+                        : cmriReplyOffset(aNode - 1) + CMRI_HEADER_LEN + (CMRI_NODES[aNode - 1].inputs * 2 + CMRI_NODES[aNode - 1].outputs) * 2 + 1;
+}
+
+const uint16_t CMRI_REPLIES_LEN = cmriReplyOffset(CMRI_NODE_COUNT);     // Poll replies of all the nodes.
+
 
 /** A CMRI interface handler using a state machine.
  */
@@ -48,12 +114,24 @@ class Cmri
     uint8_t   currentByte   = 0;            // The current byte being processed.
     CmriState cmriState     = CMRI_IDLE;    // Current state of the state machine.
     uint8_t   address       = 0;            // Address of the current message.
+    uint8_t   cmriNode      = CMRI_NODE_NONE;   // CMRI_NODES entry for the address, CMRI_NODE_NONE if not answered.
     uint8_t   messageType   = 0;            // Type of the current message.
     uint8_t   nodeType      = 0;            // Node type.
     uint16_t  transDelay    = 0;            // Delay when transmitting data - not used.
-    uint8_t   sets          = 0;            // Number of sets               - not used.
+    uint8_t   sets          = 0;            // Number of card sets (each of 4 cards) for USIC/SUSIC nodes.
+    uint8_t   inputBytes[CMRI_NODE_COUNT];  // State bytes in a poll reply, as configured by INIT.
+    uint8_t   outputBytes[CMRI_NODE_COUNT]; // State bytes acted on in a transmit message, as configured by INIT.
     uint8_t   messageLength = 0;            // Length of data message (so far).
 
+    uint8_t   replies[CMRI_REPLIES_LEN];            // Each node's poll reply, ready escaped.
+    uint8_t   replyLen[CMRI_NODE_COUNT];            // Length of each node's poll reply, zero if it hasn't been built.
+    uint16_t  replyChanges[CMRI_NODE_COUNT];        // stateChanges when each node's poll reply was built.
+
+    uint8_t   applied[CMRI_STATES_LEN];     // Transmit bytes last applied.
+    uint8_t   queued[CMRI_STATES_LEN];      // Transmit bits that have been set, waiting to be actioned.
+    uint8_t   queueCount    = 0;            // Number of bytes with queued bits.
+    uint8_t   queueIndex    = 0;            // Where to look for the next queued bit.
+
 
     public:
 
@@ -62,19 +140,49 @@ class Cmri
     Cmri(Stream& aStream):
          stream(aStream)
     {
+        memset(applied, 0, sizeof(applied));
+        memset(queued,  0, sizeof(queued));
+        memset(replyLen, 0, sizeof(replyLen));
+
+        for (uint8_t node = 0; node < CMRI_NODE_COUNT; node++)
+        {
+            inputBytes[node]  = getNodeLength(node);
+            outputBytes[node] = getNodeLength(node);
+        }
     }
 
 
     /** Update the state machine.
+     *  Consume all the buffered bytes (within CMRI_BUDGET) so a whole frame is parsed in one pass.
+     *  Stop at the end of a message unless another one follows, leaving other characters for Command
+     *  (or discarding them with SERIAL_FRAMED, as CMRI has its own channel).
+     *  Then action one queued transmit bit.
      */
     void update()
     {
-        if (   (stream.available() > 0)                 // Serial characters to process
-            && (   (cmriState != CMRI_IDLE)             // CMRI processing in progress
-                || (stream.peek() == CHAR_SYN)))        // or start of CMRI message
+        unsigned long start = micros();
+
+#if SERIAL_FRAMED
+        while (   (cmriState == CMRI_IDLE)
+               && (stream.available() > 0)
+               && (stream.peek() != CHAR_SYN))
+        {
+            stream.read();                                  // Not CMRI, and the channel is ours alone, so don't let it block.
+        }
+#endif
+
+        while (   (stream.available() > 0)                  // Serial characters to process
+               && (   (cmriState != CMRI_IDLE)              // CMRI processing in progress
+                   || (stream.peek() == CHAR_SYN))          // or start of CMRI message
+               && (micros() - start < CMRI_BUDGET))         // and time left.
         {
             processByte();
         }
+
+        if (queueCount > 0)
+        {
+            processQueue();
+        }
     }
 
 
@@ -128,7 +236,8 @@ class Cmri
                             }
                             break;
 
-            case CMRI_ADDR: address = currentByte;          // Record the address the message is for (starts with 'A').
+            case CMRI_ADDR: address  = currentByte;         // Record the address the message is for (starts with 'A').
+                            cmriNode = findNode(address);
                             cmriState = CMRI_TYPE;
                             break;
 
@@ -140,6 +249,11 @@ class Cmri
                                 nodeType    = 0;            // Node type.
                                 transDelay  = 0;            // Delay when transmitting data.
                                 sets        = 0;            // Number of sets.
+                                if (cmriNode != CMRI_NODE_NONE)
+                                {
+                                    inputBytes[cmriNode]  = 0;  // Counted from the card types.
+                                    outputBytes[cmriNode] = 0;
+                                }
                             }
                             cmriState = CMRI_DATA;
 
@@ -221,9 +335,15 @@ class Cmri
 
 
     /** Process the current byte as data.
+     *  Ignore messages for addresses that aren't answered.
      */
     void processData()
     {
+        if (cmriNode == CMRI_NODE_NONE)
+        {
+            return;
+        }
+
         switch(messageType)
         {
             case TYPE_INIT:     switch (messageLength)
@@ -250,8 +370,13 @@ class Cmri
 //                                             }
                                              break;
                     
-                                    default: // Ignore any subsequent data
-                                             // error("Init len", messageLength);
+                                    default: // Card types of a USIC/SUSIC. Ignore anything else.
+                                             if (   (   (nodeType == NODE_USIC)
+                                                     || (nodeType == NODE_SUSIC))
+                                                 && (messageLength < INIT_CARD_TYPES + sets))
+                                             {
+                                                 processCardTypes();
+                                             }
                                              break;
                                 }
                                 break;
@@ -272,34 +397,127 @@ class Cmri
     }
 
 
+    /** Process a card type byte from an INIT message.
+     *  Count the bytes of each input and output card.
+     */
+    void processCardTypes()
+    {
+        uint8_t cardBytes = (nodeType == NODE_SUSIC) ? SUSIC_CARD_BYTES : USIC_CARD_BYTES;
+
+        for (uint8_t card = 0, types = currentByte; card < CARDS_PER_TYPE; card++, types >>= 2)
+        {
+            switch (types & CARD_TYPE_MASK)
+            {
+                case CARD_TYPE_INPUT:  inputBytes[cmriNode]  += cardBytes;
+                                       break;
+
+                case CARD_TYPE_OUTPUT: outputBytes[cmriNode] += cardBytes;
+                                       break;
+
+                default:               break;
+            }
+        }
+    }
+
+
+    /** Finish an INIT message.
+     *  Size the poll reply and transmit messages to the node's layout.
+     *  Node types without a fixed layout keep all the node's Input and Output state bytes.
+     */
+    void processInit()
+    {
+        uint8_t length = getNodeLength(cmriNode);
+
+        switch (nodeType)
+        {
+            case NODE_SMINI: inputBytes[cmriNode]  = SMINI_INPUT_BYTES;
+                             outputBytes[cmriNode] = SMINI_OUTPUT_BYTES;
+                             break;
+
+            case NODE_USIC:
+            case NODE_SUSIC: break;                         // Counted from the card types.
+
+            default:         inputBytes[cmriNode]  = length;
+                             outputBytes[cmriNode] = length;
+                             break;
+        }
+
+        inputBytes[cmriNode]  = min(inputBytes[cmriNode],  length);
+        outputBytes[cmriNode] = min(outputBytes[cmriNode], length);
+        replyLen[cmriNode]    = 0;                          // Poll reply must be rebuilt.
+
+        for (uint8_t index = 0; index < length; index++)    // Next transmit applies afresh.
+        {
+            applied[getStateIndex(cmriNode, index)] = 0;
+        }
+    }
+
+
     /** Process a transmitted byte.
-     *  Action the associated Input.
+     *  Queue the bits that have been set since the byte was last applied.
+     *  JMRI resends every byte each cycle, so unchanged bytes cost nothing.
+     *  Ignore bytes beyond the configured outputs.
      */
     void processTransByte()
     {
+        if (messageLength >= outputBytes[cmriNode])
+        {
+            return;
+        }
+
 //        if (systemMgr.isReportEnabled(REPORT_SHORT))
 //        {
 //            disp.printHexByteAt(messageLength * 3, LCD_ROW_BOT, currentByte);
 //        }
 
-        bool    isInput = messageLength < (INPUT_NODE_MAX * 2);                     // Input nodes sent first, 2 bytes per Input node, then Output nodes.
-        uint8_t node    = (isInput ? (messageLength >> 1)                           // Inputs use two bytes per node.
-                                   : (messageLength - (INPUT_NODE_MAX * 2)));       // Outputs start after 2 * INPUT_NODE_MAX bytes, 1 byte per node.
-        uint8_t pin     = (isInput ? (messageLength & 1) << 3 : 0);                 // Start at pin zero except 2nd byte of Input node starts at 8.
-        
-        for (uint8_t mask = 1; mask > 0; pin++, mask <<= 1)
+        uint8_t index   = getStateIndex(cmriNode, messageLength);
+        uint8_t changed = currentByte & ~applied[index];                            // CMRI signal going high means fire the Input/Output.
+        applied[index]  = currentByte;
+
+        if (changed != 0)
         {
-            if ((currentByte & mask) != 0)                                          // CMRI signal high means fire the Input/Output.
+            if (queued[index] == 0)
             {
-                if (isInput)
-                {
-                    controller.processInput(node, pin, false);
-                }
-                else
-                {
-                    controller.processOutput(node, pin, !outputCtl.getOutputState(node, pin), 0);
-                }
+                queueCount += 1;
             }
+            queued[index] |= changed;
+        }
+    }
+
+
+    /** Action the next queued transmit bit.
+     *  Input nodes sent first, 2 bytes per Input node, then Output nodes, 1 byte per node.
+     */
+    void processQueue()
+    {
+        while (queued[queueIndex] == 0)
+        {
+            queueIndex = (queueIndex + 1) % CMRI_STATES_LEN;
+        }
+
+        uint8_t index = queueIndex;
+        uint8_t bits  = queued[index];
+        uint8_t bit   = 0;
+
+        while ((bits & (1 << bit)) == 0)
+        {
+            bit += 1;
+        }
+
+        queued[index] = bits & ~(1 << bit);
+        if (queued[index] == 0)
+        {
+            queueCount -= 1;
+        }
+
+        if (index < INPUT_NODE_MAX * 2)
+        {
+            controller.processInput(index >> 1, ((index & 1) << 3) + bit, false);   // 2nd byte of Input node starts at pin 8.
+        }
+        else
+        {
+            uint8_t node = index - INPUT_NODE_MAX * 2;
+            controller.processOutput(node, bit, !outputCtl.getOutputState(node, bit), 0);
         }
     }
 
@@ -310,49 +528,124 @@ class Cmri
      */
     void processEndOfMessage()
     {
+        if (cmriNode == CMRI_NODE_NONE)
+        {
+            // Not our address.
+        }
+        else if (messageType == TYPE_INIT)
+        {
+            processInit();
+        }
+
         // If message was a poll, respond with the current state.
-        if (messageType == TYPE_POLL)
+        else if (messageType == TYPE_POLL)
         {
-            // Send CMRI header
-            sendByte(CHAR_SYN, false);
-            sendByte(CHAR_SYN, false);
-            sendByte(CHAR_STX, false);
-            sendByte(address,  false);
-            sendByte(TYPE_RECEIVE, false);
-
-            // Send Input node states.
-            for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
-            {
-                uint16_t inputStates = controller.getInputState(node);
-                sendByte((inputStates     ) & 0xff, true);
-                sendByte((inputStates >> 8) & 0xff, true);
-            }
+            // Each node keeps its own reply, rebuilt only if an Input or Output state has changed since it was built.
+            uint8_t* reply = replies + cmriReplyOffset(cmriNode);
 
-            // Send Output node states.
-            for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+            if (   (replyLen[cmriNode] == 0)
+                || (replyChanges[cmriNode] != stateChanges))
             {
-                sendByte(outputCtl.getOutputStates(node) & 0xff, true);
+                buildReply(reply);
             }
 
-            sendByte(CHAR_ETX, false);
-            //stream.flush();
+            reply[CMRI_ADDR_OFFSET] = address;
+            stream.write(reply, replyLen[cmriNode]);
+        }
+    }
+
+
+    /** Build the current node's poll reply from its Input and Output states.
+     */
+    void buildReply(uint8_t* aReply)
+    {
+        uint8_t length = 0;
+
+        // CMRI header
+        aReply[length++] = CHAR_SYN;
+        aReply[length++] = CHAR_SYN;
+        aReply[length++] = CHAR_STX;
+        aReply[length++] = address;
+        aReply[length++] = TYPE_RECEIVE;
+
+        // As many state bytes as the node is configured for.
+        for (uint8_t index = 0; index < inputBytes[cmriNode]; index++)
+        {
+            addReplyByte(aReply, length, getStateByte(getStateIndex(cmriNode, index)));
         }
+
+        aReply[length++] = CHAR_ETX;
+
+        replyLen[cmriNode]     = length;
+        replyChanges[cmriNode] = stateChanges;
     }
 
 
-    /** Send a byte (as a character).
-     *  If escape flag is set, precede special characters with CHAR_DLE.
+    /** Find the CMRI_NODES entry that answers the given address.
      */
-    void sendByte(uint8_t aByte, boolean escape)
+    uint8_t findNode(uint8_t aAddress)
     {
-        if (escape)
+        for (uint8_t node = 0; node < CMRI_NODE_COUNT; node++)
         {
-            if (aByte <= CHAR_DLE)
+            if (   (CMRI_NODES[node].address == aAddress)
+                || (CMRI_NODES[node].address == CMRI_ADDR_ANY))
             {
-                stream.write(CHAR_DLE);
+                return node;
             }
         }
-        stream.write(aByte);
+
+        return CMRI_NODE_NONE;
+    }
+
+
+    /** Gets the number of state bytes of a CMRI node.
+     */
+    uint8_t getNodeLength(uint8_t aNode)
+    {
+        return CMRI_NODES[aNode].inputs * 2 + CMRI_NODES[aNode].outputs;
+    }
+
+
+    /** Gets the index into all the states of a CMRI node's state byte.
+     *  The node's Input nodes first, 2 bytes per node, then its Output nodes, 1 byte per node.
+     */
+    uint8_t getStateIndex(uint8_t aNode, uint8_t aIndex)
+    {
+        const CmriNode& node = CMRI_NODES[aNode];
+
+        if (aIndex < node.inputs * 2)
+        {
+            return node.firstInput * 2 + aIndex;
+        }
+
+        return INPUT_NODE_MAX * 2 + node.firstOutput + aIndex - node.inputs * 2;
+    }
+
+
+    /** Gets a byte of all the states.
+     *  Input node states first, 2 bytes per Input node, then Output node states, 1 byte per Output node.
+     */
+    uint8_t getStateByte(uint8_t aIndex)
+    {
+        if (aIndex < INPUT_NODE_MAX * 2)
+        {
+            return (controller.getInputState(aIndex >> 1) >> ((aIndex & 1) << 3)) & 0xff;
+        }
+
+        return outputCtl.getOutputStates(aIndex - INPUT_NODE_MAX * 2) & 0xff;
+    }
+
+
+    /** Add a data byte to a poll reply.
+     *  Precede special characters with CHAR_DLE.
+     */
+    void addReplyByte(uint8_t* aReply, uint8_t& aLength, uint8_t aByte)
+    {
+        if (aByte <= CHAR_DLE)
+        {
+            aReply[aLength++] = CHAR_DLE;
+        }
+        aReply[aLength++] = aByte;
     }
 
 
@@ -14,51 +14,107 @@
 #define Command_h
 
 const uint8_t COMMAND_BUFFER_LEN = 8;               // Serial command buffer length
+const uint8_t COMMAND_QUEUE_LEN  = 8;               // Commands received but not yet executed.
+const uint8_t COMMAND_LEN        = 3;               // Command character, node and pin (the longest command).
+const uint8_t COMMAND_PUSH_LEN   = 18;              // Longest watch line, "*iNFFFF@FFFFFFFF" and CR/LF.
+
+// Acknowledgement codes, sent with the command's sequence number (2 hex digits), eg "+1A".
+const char    COMMAND_ACK        = '+';             // Command executed.
+const char    COMMAND_NACK       = '-';             // Command not recognised, or node/pin out of range.
+const char    COMMAND_BUSY       = '!';             // Command queue full, command discarded.
+
+// State reports.
+const char    COMMAND_QUERY      = '=';             // Reply to a query, eg "=o3A5".
+const char    COMMAND_PUSH       = '*';             // Watched state change, with time (msecs in hex), eg "*o3A5@1F2C".
+const char    COMMAND_TIME       = '@';             // Precedes the time of a watched state change.
+const char    COMMAND_OUTPUT     = 'o';             // Output node states (2 hex digits).
+const char    COMMAND_INPUT      = 'i';             // Input node states (4 hex digits).
+
+
+/** A received command, waiting to be executed.
+ */
+struct CommandEntry
+{
+    char    command[COMMAND_LEN + 1];               // The command, with null terminator.
+    uint8_t sequence;                               // Sequence number it was acknowledged with.
+};
 
 
 /** Command class.
- *  Handles input from Serial input and executes the commands received.
+ *  Handles input from a Stream (normally Serial) and executes the commands received.
+ *  Each command is numbered and acknowledged with a code and its sequence number (see COMMAND_ACK etc).
  */
 class Command
 {
     private:
 
+    Stream& stream;                                 // Stream for the commands and their replies.
     char    commandBuffer[COMMAND_BUFFER_LEN + 1];  // Buffer to read characters with null terminator on the end.
     uint8_t commandLen = 0;                         // Length of command.
+    uint8_t sequence   = 0;                         // Sequence number of the next command received.
+    bool    watching   = false;                     // Push Input and Output state changes.
+
+    CommandEntry queue[COMMAND_QUEUE_LEN];          // Commands waiting to be executed.
+    uint8_t      queueHead  = 0;                    // Next command to execute.
+    uint8_t      queueCount = 0;                    // Number of commands waiting.
 
 
     public:
-    
+
+    /** A Command handler using the given Stream.
+     */
+    Command(Stream& aStream):
+            stream(aStream)
+    {
+    }
+
+
     /** Look for serial input and process it.
+     *  Read all the buffered characters, queueing complete commands (comma or newline separated).
+     *  Then execute one queued command, so a batch is pipelined with reading the rest of it.
      */
     void update()
     {
         // Look for command characters
-        if (Serial.available() > 0)
+        while (   (stream.available() > 0)
+               && (   (commandLen > 0)                  // Already processing a command.
+                   || (SERIAL_FRAMED)                   // Or CMRI has its own channel
+                   || (stream.peek() != CHAR_SYN)))     // Or character can't be a CMRI start-of-message
         {
-            if (   (commandLen > 0)                     // Already processing a command.
-                || (Serial.peek() != CHAR_SYN))         // Or character can't be a CMRI start-of-message
+            char ch = stream.read();
+            if (ch == CHAR_RETURN)
             {
-                char ch = Serial.read();
-                if (ch == CHAR_RETURN)
-                {
-                    // Ignore carriage-return
-                }
-                else if (   (ch == CHAR_NEWLINE)
-                         || (ch == CHAR_COMMA))
-                {
-                    if (commandLen > 0)                 // Process the received command
-                    {
-                        commandBuffer[commandLen] = CHAR_NULL;
-                        processCommand();
-                        commandLen = 0;
-                    }
-                }
-                else if (commandLen < COMMAND_BUFFER_LEN)
+                // Ignore carriage-return
+            }
+            else if (   (ch == CHAR_NEWLINE)
+                     || (ch == CHAR_COMMA))
+            {
+                if (commandLen > 0)                     // Queue the received command
                 {
-                    commandBuffer[commandLen++] = ch;   // Add the character to the command.
+                    commandBuffer[commandLen] = CHAR_NULL;
+                    queueCommand();
+                    commandLen = 0;
                 }
             }
+            else if (commandLen < COMMAND_BUFFER_LEN)
+            {
+                commandBuffer[commandLen++] = ch;       // Add the character to the command.
+            }
+        }
+
+        if (queueCount > 0)
+        {
+            CommandEntry& entry = queue[queueHead];
+            acknowledge(processCommand(entry.command) ? COMMAND_ACK : COMMAND_NACK, entry.sequence);
+
+            queueHead   = (queueHead + 1) % COMMAND_QUEUE_LEN;
+            queueCount -= 1;
+        }
+
+        if (   (watching)
+            && (outputChanged | inputChanged))
+        {
+            pushChanges();
         }
     }
 
@@ -73,15 +129,212 @@ class Command
 
 
     private:
-    
+
+    /** Queue the command in the commandBuffer, giving it the next sequence number.
+     *  Commands that can't be executed (too long, or no room) are acknowledged immediately.
+     */
+    void queueCommand()
+    {
+        uint8_t seq = sequence++;
+
+        if (commandLen > COMMAND_LEN)
+        {
+            reportUnknown(commandBuffer);
+            acknowledge(COMMAND_NACK, seq);
+        }
+        else if (queueCount >= COMMAND_QUEUE_LEN)
+        {
+            acknowledge(COMMAND_BUSY, seq);
+        }
+        else
+        {
+            CommandEntry& entry = queue[(queueHead + queueCount) % COMMAND_QUEUE_LEN];
+            strcpy(entry.command, commandBuffer);
+            entry.sequence = seq;
+            queueCount += 1;
+        }
+    }
+
+
+    /** Send an acknowledgement code and sequence number, eg "+1A".
+     */
+    void acknowledge(char aCode, uint8_t aSequence)
+    {
+        stream.print(aCode);
+        stream.print(HEX_CHARS[(aSequence >> 4) & 0x0f]);
+        stream.println(HEX_CHARS[aSequence & 0x0f]);
+    }
+
+
+    /** Push the Input and Output nodes whose states have changed.
+     *  As many as fit in the stream's output buffer, the rest are pushed later.
+     */
+    void pushChanges()
+    {
+        for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+        {
+            if (stream.availableForWrite() < COMMAND_PUSH_LEN)
+            {
+                return;
+            }
+
+            if (outputChanged & ((OutputNodes)1 << node))
+            {
+                outputChanged &= ~((OutputNodes)1 << node);
+                reportOutputNode(COMMAND_PUSH, node);
+            }
+        }
+
+        for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
+        {
+            if (stream.availableForWrite() < COMMAND_PUSH_LEN)
+            {
+                return;
+            }
+
+            if (inputChanged & ((InputNodes)1 << node))
+            {
+                inputChanged &= ~((InputNodes)1 << node);
+                reportInputNode(COMMAND_PUSH, node);
+            }
+        }
+    }
+
+
+    /** Report an Output node's states, eg "=o3A5", or "*o3A5@1F2C" if pushed.
+     */
+    void reportOutputNode(char aCode, uint8_t aNode)
+    {
+        stream.print(aCode);
+        stream.print(COMMAND_OUTPUT);
+        stream.print(HEX_CHARS[aNode]);
+        printHex(outputCtl.getOutputStates(aNode), 2);
+        reportTime(aCode);
+    }
+
+
+    /** Report an Input node's states, eg "=i2FFFE", or "*i2FFFE@1F2C" if pushed.
+     */
+    void reportInputNode(char aCode, uint8_t aNode)
+    {
+        stream.print(aCode);
+        stream.print(COMMAND_INPUT);
+        stream.print(HEX_CHARS[aNode]);
+        printHex(controller.getInputState(aNode), 4);
+        reportTime(aCode);
+    }
+
+
+    /** End a report, with the time if it's pushed.
+     */
+    void reportTime(char aCode)
+    {
+        if (aCode == COMMAND_PUSH)
+        {
+            stream.print(COMMAND_TIME);
+            stream.print(millis(), HEX);
+        }
+        stream.println();
+    }
+
+
+    /** Print a value as the given number of hex digits.
+     */
+    void printHex(uint16_t aValue, uint8_t aDigits)
+    {
+        while (aDigits-- > 0)
+        {
+            stream.print(HEX_CHARS[(aValue >> (aDigits * 4)) & 0x0f]);
+        }
+    }
+
+
+    /** Process a query command.
+     *  Return true if it was executed.
+     *      g   - Report all Output nodes' states, then all Input nodes' states.
+     *      gN  - Report Output node N's states.
+     *      gNP - Report Output node N, pin P's state, eg "=o3A1".
+     */
+    bool processQuery(char* aCommand)
+    {
+        uint8_t len  = strlen(aCommand);
+        uint8_t node = (len > 1) ? charToNode(aCommand[1]) : 0;
+        uint8_t pin  = (len > 2) ? charToHex(aCommand[2]) : 0;
+
+        if (len == 1)
+        {
+            for (node = 0; node < OUTPUT_NODE_MAX; node++)
+            {
+                reportOutputNode(COMMAND_QUERY, node);
+            }
+            for (node = 0; node < INPUT_NODE_MAX; node++)
+            {
+                reportInputNode(COMMAND_QUERY, node);
+            }
+        }
+        else if (node >= OUTPUT_NODE_MAX)
+        {
+            return false;
+        }
+        else if (len == 2)
+        {
+            reportOutputNode(COMMAND_QUERY, node);
+        }
+        else if (pin < OUTPUT_PIN_MAX)
+        {
+            stream.print(COMMAND_QUERY);
+            stream.print(COMMAND_OUTPUT);
+            stream.print(HEX_CHARS[node]);
+            stream.print(HEX_CHARS[pin]);
+            stream.println(outputCtl.getOutputState(node, pin) ? 1 : 0);
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /** Process a watch command.
+     *  Return true if it was executed.
+     *      w1  - Start pushing Input and Output state changes, eg "*o3A5@1F2C".
+     *      w0  - Stop pushing state changes.
+     */
+    bool processWatch(char* aCommand)
+    {
+        if (strlen(aCommand) != 2)
+        {
+            return false;
+        }
+
+        switch (aCommand[1])
+        {
+            case '1': outputChanged = 0;        // Only changes from now on.
+                      inputChanged  = 0;
+                      watching      = true;
+                      return true;
+
+            case '0': watching      = false;
+                      return true;
+
+            default:  return false;
+        }
+    }
+
+
     /** Process a received command.
-     *  Using the contents of the commandBuffer:
+     *  Return true if it was executed.
+     *  Using the contents of the command:
      *      iNP - Action input for node N, pin P.
      *      lNP - Action output Lo for node N, pin P.
      *      hNP - Action output Hi for node N, pin P.
      *      oNP - Action output Hi/Lo (based on current state) for node N, pin P.
+     *      g.. - Query states, see processQuery().
+     *      w.  - Watch state changes, see processWatch().
      */
-    void processCommand()
+    bool processCommand(char* aCommand)
     {
         bool    executed = false;
         uint8_t node     = 0;
@@ -92,16 +345,25 @@ class Command
         {
             Serial.print(PGMT(M_INPUT));
             Serial.print(PGMT(M_DEBUG_COMMAND));
-            Serial.println(commandBuffer);
+            Serial.println(aCommand);
         }
     
+        if ((aCommand[0] | 0x20) == 'g')
+        {
+            executed = processQuery(aCommand);
+        }
+        else if ((aCommand[0] | 0x20) == 'w')
+        {
+            executed = processWatch(aCommand);
+        }
+
         // Expect three characters, command, nodeId, pinId
-        if (commandLen == 3)
+        else if (strlen(aCommand) == COMMAND_LEN)
         {
-            node = charToHex(commandBuffer[1]);
-            pin  = charToHex(commandBuffer[2]);
+            node = charToNode(aCommand[1]);
+            pin  = charToHex(aCommand[2]);
     
-            switch (commandBuffer[0] | 0x20)            // Command character converted to lower-case.
+            switch (aCommand[0] | 0x20)                 // Command character converted to lower-case.
             {
                 case 'i': if (   (node < INPUT_NODE_MAX)
                               && (pin  < INPUT_PIN_MAX))
@@ -130,22 +392,32 @@ class Command
         // Report error if not executed.
         if (!executed)
         {
-            if (isDebug(DEBUG_ERRORS))
-            {
-                Serial.print(PGMT(M_UNKNOWN));
-                Serial.print(PGMT(M_DEBUG_COMMAND));
-                Serial.println(commandBuffer);
-            }
-    
-            if (systemMgr.isReportEnabled(REPORT_SHORT))
-            {
-                disp.clearRow(LCD_COL_START, LCD_ROW_BOT);
-                disp.setCursor(LCD_COL_START, LCD_ROW_BOT);
-                disp.printProgStr(M_UNKNOWN);
-                disp.printCh(CHAR_SPACE);
-                disp.printStr(commandBuffer);
-                controller.setDisplayTimeout(systemMgr.getReportDelay());
-            }
+            reportUnknown(aCommand);
+        }
+
+        return executed;
+    }
+
+
+    /** Report a command that can't be executed.
+     */
+    void reportUnknown(char* aCommand)
+    {
+        if (isDebug(DEBUG_ERRORS))
+        {
+            Serial.print(PGMT(M_UNKNOWN));
+            Serial.print(PGMT(M_DEBUG_COMMAND));
+            Serial.println(aCommand);
+        }
+
+        if (systemMgr.isReportEnabled(REPORT_SHORT))
+        {
+            disp.clearRow(LCD_COL_START, LCD_ROW_BOT);
+            disp.setCursor(LCD_COL_START, LCD_ROW_BOT);
+            disp.printProgStr(M_UNKNOWN);
+            disp.printCh(CHAR_SPACE);
+            disp.printStr(aCommand);
+            controller.setDisplayTimeout(systemMgr.getReportDelay());
         }
     }
 };
@@ -562,9 +562,20 @@ class Configure
     {
         int response = aOldNode;
 
+        outputCtl.forgetSent();     // Node numbers and locks are about to change.
+
+        // A module can't be renumbered onto another multiplexer segment, it would become unreachable.
+        if (   (I2C_MUX_MAX > 0)
+            && (!COMMS_RS485)
+            && (aNewNode != I2C_MODULE_ID_JUMPERS)
+            && (i2cComms.getSegment(aNewNode) != i2cComms.getSegment(aOldNode)))
+        {
+            configFail(M_RENUMBER, aNewNode);
+        }
+
         // Send the renumber command to the node concerned.
-        if (   ((response = i2cComms.sendData(I2C_OUTPUT_BASE_ID + aOldNode, COMMS_CMD_SYSTEM | COMMS_SYS_RENUMBER, aOldNode, aNewNode)) == 0)
-            && ((response = i2cComms.requestByte(I2C_OUTPUT_BASE_ID + aOldNode)) >= 0))
+        else if (   ((response = i2cComms.sendData(i2cComms.outputId(aOldNode), COMMS_CMD_SYSTEM | COMMS_SYS_RENUMBER, aOldNode, aNewNode)) == 0)
+                 && ((response = i2cComms.requestByte(i2cComms.outputId(aOldNode))) >= 0))
         {
             response &= OUTPUT_NODE_MASK;       // The new node number of the Output as returned by the node
 
@@ -593,11 +604,15 @@ class Configure
                 disp.clearRow(LCD_COL_START, LCD_ROW_DET);
                 disp.printProgStrAt(LCD_COL_START, LCD_ROW_TOP, M_RENUMBER);
                 disp.printProgStrAt(LCD_COL_START, LCD_ROW_DET, M_INPUT, LCD_LEN_OPTION);
-                disp.setCursor(-INPUT_NODE_MAX, LCD_ROW_DET);
 
                 // Renumber all the effected inputs' Output nodes.
                 for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
                 {
+                    if ((node % LCD_COLS) == 0)
+                    {
+                        disp.setCursor(-min(INPUT_NODE_MAX - node, LCD_COLS), LCD_ROW_DET);
+                    }
+
                     if (isInputNodePresent(node))
                     {
                         disp.printHexCh(node);
@@ -633,15 +648,11 @@ class Configure
                 // Show work as Output locks are updated.
                 disp.clearBottomRows();
                 disp.printProgStrAt(LCD_COL_START, LCD_ROW_DET, M_OUTPUT, LCD_LEN_OPTION);
-                disp.setCursor(-OUTPUT_NODE_HALF, LCD_ROW_EDT);
 
                 // Renumber all the Outputs' locks as necessary.
                 for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
                 {
-                    if (node == OUTPUT_NODE_HALF)
-                    {
-                        disp.setCursor(-OUTPUT_NODE_HALF, LCD_ROW_BOT);
-                    }
+                    controller.dispNodeMapAt(node);
                     if (outputCtl.isOutputNodePresent(node))
                     {
                         disp.printHexCh(node);
@@ -658,7 +669,7 @@ class Configure
                             Serial.println();
                         }
 
-                        i2cComms.sendData(I2C_OUTPUT_BASE_ID + node, COMMS_CMD_SYSTEM | COMMS_SYS_MOVE_LOCKS, aOldNode, response);
+                        i2cComms.sendData(i2cComms.outputId(node), COMMS_CMD_SYSTEM | COMMS_SYS_MOVE_LOCKS, aOldNode, response);
                     }
                     else
                     {
@@ -1124,7 +1135,7 @@ class Configure
                                         }
                                         disp.printDecAt(LCD_COL_OUTPUT_LO, LCD_ROW_BOT, outputDef.getLo(), OUTPUT_HI_LO_SIZE);
                                         // writeOutput();
-                                        i2cComms.sendData(I2C_OUTPUT_BASE_ID + outNode, COMMS_CMD_SET | outPin, outputDef.getLo(), -1);
+                                        i2cComms.sendData(i2cComms.outputId(outNode), COMMS_CMD_SET | outPin, outputDef.getLo(), -1);
                                         delay(autoRepeat);
                                         autoRepeat = DELAY_BUTTON_REPEAT;
                                     }
@@ -1141,7 +1152,7 @@ class Configure
                                         }
                                         disp.printDecAt(LCD_COL_OUTPUT_LO, LCD_ROW_BOT, outputDef.getLo(), OUTPUT_HI_LO_SIZE);
                                         // writeOutput();
-                                        i2cComms.sendData(I2C_OUTPUT_BASE_ID + outNode, COMMS_CMD_SET | outPin, outputDef.getLo(), -1);
+                                        i2cComms.sendData(i2cComms.outputId(outNode), COMMS_CMD_SET | outPin, outputDef.getLo(), -1);
                                         delay(autoRepeat);
                                         autoRepeat = DELAY_BUTTON_REPEAT;
                                     }
@@ -1199,7 +1210,7 @@ class Configure
                                         }
                                         disp.printDecAt(LCD_COL_OUTPUT_HI, LCD_ROW_BOT, outputDef.getHi(), OUTPUT_HI_LO_SIZE);
                                         // writeOutput();
-                                        i2cComms.sendData(I2C_OUTPUT_BASE_ID + outNode, COMMS_CMD_SET | outPin, outputDef.getHi(), -1);
+                                        i2cComms.sendData(i2cComms.outputId(outNode), COMMS_CMD_SET | outPin, outputDef.getHi(), -1);
                                         delay(autoRepeat);
                                         autoRepeat = DELAY_BUTTON_REPEAT;
                                     }
@@ -1216,7 +1227,7 @@ class Configure
                                         }
                                         disp.printDecAt(LCD_COL_OUTPUT_HI, LCD_ROW_BOT, outputDef.getHi(), OUTPUT_HI_LO_SIZE);
                                         // writeOutput();
-                                        i2cComms.sendData(I2C_OUTPUT_BASE_ID + outNode, COMMS_CMD_SET | outPin, outputDef.getHi(), -1);
+                                        i2cComms.sendData(i2cComms.outputId(outNode), COMMS_CMD_SET | outPin, outputDef.getHi(), -1);
                                         delay(autoRepeat);
                                         autoRepeat = DELAY_BUTTON_REPEAT;
                                     }
@@ -2095,6 +2106,7 @@ class Configure
         uint8_t       button      = BUTTON_NONE;
         unsigned long interval    = 0L;           // Interval between changes of output.
         unsigned long finishAt    = 0L;           // Time to finish output's ident.
+        uint8_t       loadedNode  = OUTPUT_NODE_MAX;  // Node whose definitions have been read.
 
         buttons.waitForButtonRelease();
         if (outputNodes == 0)
@@ -2116,7 +2128,12 @@ class Configure
                     // Test all the pins in turn.
                     for (int pin = 0; pin < OUTPUT_PIN_MAX && !interrupted; ) // pin++)
                     {
-                        outputCtl.readOutput(node, pin);
+                        if (node != loadedNode)
+                        {
+                            outputCtl.readOutputNode(node);
+                            loadedNode = node;
+                        }
+                        outputCtl.loadOutput(node, pin);
 
                         // Pin is active, test it.
                         if (outputDef.getType() != OUTPUT_TYPE_NONE)
@@ -2175,7 +2192,7 @@ class Configure
 
                                 case BUTTON_LEFT:   for (pin -= 1; pin > 0; pin--)
                                                     {
-                                                        outputCtl.readOutput(node, pin);
+                                                        outputCtl.loadOutput(node, pin);
                                                         if (outputDef.getType() != OUTPUT_TYPE_NONE)
                                                         {
                                                             break;
@@ -2232,11 +2249,12 @@ class Configure
      */
     uint8_t nextNode(uint8_t aStart, int aAdjust, bool aIsInput, bool aInUse)
     {
-        uint8_t next = aStart & (aIsInput ? INPUT_NODE_MASK : OUTPUT_NODE_MASK);
+        uint8_t limit = aIsInput ? INPUT_NODE_MAX : OUTPUT_NODE_MAX;
+        uint8_t next  = aStart % limit;
 
-        for (uint8_t ind = 0; ind < (aIsInput ? INPUT_NODE_MAX : OUTPUT_NODE_MAX); ind++)
+        for (uint8_t ind = 0; ind < limit; ind++)
         {
-            next = (next + aAdjust) & (aIsInput ? INPUT_NODE_MASK : OUTPUT_NODE_MASK);
+            next = (next + limit + aAdjust) % limit;
 
             if (   (aIsInput)
                 && (aInUse == isInputNodePresent(next)))
@@ -2255,7 +2273,7 @@ class Configure
             && (next   == aStart)                           // Didn't find a suitable input.
             && (aInUse != isInputNodePresent(next)))        // And this node isn't correct either.
         {
-            next = (next + aAdjust) & INPUT_NODE_MASK;
+            next = (next + INPUT_NODE_MAX + aAdjust) % INPUT_NODE_MAX;
         }
 
         return next;
@@ -23,7 +23,8 @@ class Controller
 
     unsigned long tickHardwareScan = 0L;        // Time for next scan for hardware.
     unsigned long tickInputScan    = 0L;        // Time for next scan of input switches.
-    unsigned long tickGateway      = 0L;        // Time for next gateway request.
+    unsigned long tickGateway      = 0L;        // Time for next gateway poll (if it can't signal).
+    unsigned long tickChanges      = 0L;        // Time to next send the gateway state changes.
 
     unsigned long tickHeartBeat    = 0L;        // Time for next heartbeat.
 
@@ -33,6 +34,23 @@ class Controller
     unsigned long timeoutBuzzer    = 0L;        // Time at which buzzer2 sound should be made.
 
     uint16_t      inputState[INPUT_NODE_MAX];   // Current state of inputs.
+    uint16_t      busRecoveries    = 0;         // I2C bus recoveries already reported.
+    uint8_t       snapshotVersion  = 0;         // Version of the last state snapshot sent to the Gateway.
+    volatile bool gatewayAttention = true;      // Gateway has rung its doorbell (or may have more requests).
+
+
+    /** Record the state of an Input node's pins.
+     */
+    void setInputState(uint8_t aNode, uint16_t aState)
+    {
+        if (inputState[aNode] != aState)
+        {
+            inputState[aNode] = aState;
+            stateChanges += 1;
+            inputChanged  |= (InputNodes)1 << aNode;
+            gatewayInputs |= (InputNodes)1 << aNode;
+        }
+    }
 
 
     public:
@@ -78,6 +96,25 @@ class Controller
             }
         }
 
+        // Report any I2C bus recovery, and rescan at once for nodes lost during the stall.
+        if (i2cComms.getRecoveries() != busRecoveries)
+        {
+            busRecoveries    = i2cComms.getRecoveries();
+            tickHardwareScan = 0L;
+
+            if (isDebug(DEBUG_ERRORS))
+            {
+                Serial.print(PGMT(M_DEBUG_RECOVER));
+                Serial.print(PGMT(M_DEBUG_COUNT));
+                Serial.print(busRecoveries);
+                Serial.print(PGMT(M_DEBUG_TIME));
+                Serial.print(i2cComms.getRecoveryMicros());
+                Serial.print(PGMT(M_DEBUG_MAX));
+                Serial.print(i2cComms.getRecoveryMicrosMax());
+                Serial.println();
+            }
+        }
+
         // Rescan for new hardware
         if (   (STEP_HARDWARE_SCAN > 0)
             && (now > tickHardwareScan))
@@ -96,16 +133,26 @@ class Controller
             scanInputs(NULL);
         }
     
-        // See if there are any Gateway requests
+        // Collect the Gateway's requests, if it has any.
         if (   (I2C_GATEWAY_ID > 0)
-            && (now > tickGateway))
+            && (isGatewayWaiting(now)))
         {
-            if (!gatewayRequest())
+            gatewayAttention = false;
+            if (gatewayRequest())
             {
-                tickGateway = now + STEP_GATEWAY;
+                gatewayAttention = true;
             }
         }
 
+        // Send the Gateway any state changes.
+        if (   (I2C_GATEWAY_ID > 0)
+            && (now > tickChanges)
+            && (gatewayOutputs | gatewayInputs))
+        {
+            tickChanges = now + STEP_GATEWAY_CHANGES;
+            gatewayChanges();
+        }
+
         // If display timeout has expired, clear it.
         if (   (displayTimeout > 0)
             && (now > displayTimeout))
@@ -216,12 +263,12 @@ class Controller
                     }
 
                     // Record new input states.
-                    inputState[node] = pins;
+                    setInputState(node, pins);
                 }
             }
             else
             {
-                inputState[node] = 0xffff;
+                setInputState(node, 0xffff);
             }
         }
     }
@@ -355,7 +402,7 @@ class Controller
         {
             if (outputCtl.isOutputNodePresent(node))
             {
-                i2cComms.sendShort(I2C_OUTPUT_BASE_ID + node, COMMS_CMD_DEBUG | (systemMgr.getDebugLevel() & COMMS_OPTION_MASK));
+                i2cComms.sendShort(i2cComms.outputId(node), COMMS_CMD_DEBUG | (systemMgr.getDebugLevel() & COMMS_OPTION_MASK));
 
                 if (isDebug(DEBUG_BRIEF))
                 {
@@ -371,6 +418,72 @@ class Controller
     }
 
 
+    /** The Gateway has rung its doorbell, it has requests waiting.
+     *  Called from the I2C receive handler.
+     */
+    void gatewayDoorbell()
+    {
+        gatewayAttention = true;
+    }
+
+
+    /** Send the Gateway a snapshot of all the node states, in chunks.
+     *  Output node states (1 byte each), then Input node states (2 bytes each, high byte first).
+     */
+    void gatewaySnapshot()
+    {
+        uint8_t data[COMMS_SNAPSHOT_HEADER + COMMS_SNAPSHOT_CHUNK];
+        uint8_t total = OUTPUT_NODE_MAX + INPUT_NODE_MAX * 2;
+
+        snapshotVersion += 1;
+        gatewayOutputs   = 0;                               // Everything is being sent.
+        gatewayInputs    = 0;
+
+        for (uint8_t offset = 0; offset < total; offset += COMMS_SNAPSHOT_CHUNK)
+        {
+            uint8_t len = 0;
+
+            data[len++] = snapshotVersion;
+            data[len++] = offset;
+            data[len++] = total;
+
+            for (uint8_t index = offset; (index < total) && (index < offset + COMMS_SNAPSHOT_CHUNK); index++)
+            {
+                if (index < OUTPUT_NODE_MAX)
+                {
+                    data[len++] = outputCtl.getOutputStates(index);
+                }
+                else
+                {
+                    uint8_t node = (index - OUTPUT_NODE_MAX) >> 1;
+                    data[len++]  = ((index - OUTPUT_NODE_MAX) & 1) ? (getInputState(node)      & 0xFF)
+                                                                   : ((getInputState(node) >> 8) & 0xFF);
+                }
+            }
+
+            i2cComms.sendGatewayBuffer(COMMS_CMD_SYSTEM | COMMS_SYS_SNAPSHOT, data, len);
+        }
+    }
+
+
+    /** Move to an Output node's place in the LCD's map of the Output nodes.
+     *  OUTPUT_NODE_ROW nodes on each of the bottom two rows, waiting for a click before starting another page of them.
+     */
+    void dispNodeMapAt(uint8_t aNode)
+    {
+        if ((aNode % OUTPUT_NODE_ROW) == 0)
+        {
+            if (   (aNode > 0)
+                && ((aNode % (OUTPUT_NODE_ROW * 2)) == 0))
+            {
+                buttons.waitForButtonClick();
+            }
+
+            disp.setCursor(-OUTPUT_NODE_ROW, ((aNode / OUTPUT_NODE_ROW) & 1) ? LCD_ROW_BOT : LCD_ROW_EDT);
+        }
+    }
+
+
     private:
 
     /** Process the changed input for the current Input.
@@ -432,7 +545,6 @@ class Controller
             // If not locked, process the Input's Outputs.
             if (!isLocked(newState))
             {
-                i2cComms.sendGateway((newState ? COMMS_CMD_INP_HI : COMMS_CMD_INP_LO) | pin, node, -1);
                 processInputOutputs(newState);
             }
 
@@ -452,25 +564,26 @@ class Controller
         {
             if (!isInputNodePresent(node))
             {
-                if (disp.getLcdId() != (I2C_INPUT_BASE_ID + node))
+                // The LCD is on the main bus, and so on every segment. An Input at its address would collide with it.
+                if (disp.getLcdId() != lowByte(i2cComms.inputId(node)))
                 {
                     // Send message to the Input and see if it responds.
-                    if (i2cComms.exists(I2C_INPUT_BASE_ID + node))
+                    if (i2cComms.exists(i2cComms.inputId(node)))
                     {
                         setInputNodePresent(node, true);
 
                         // Configure MCP for input.
                         for (uint8_t command = 0; command < INPUT_COMMANDS_LEN; command++)
                         {
-                            i2cComms.sendData(I2C_INPUT_BASE_ID + node, INPUT_COMMANDS[command], MCP_ALL_HIGH, -1);
+                            i2cComms.sendData(i2cComms.inputId(node), INPUT_COMMANDS[command], MCP_ALL_HIGH, -1);
                         }
 
                         // Record current switch state
-                        inputState[node] = readInputNode(node);
+                        setInputState(node, readInputNode(node));
                     }
                     else
                     {
-                        inputState[node] = 0xffff;
+                        setInputState(node, 0xffff);
                     }
                 }
             }
@@ -486,16 +599,20 @@ class Controller
         disp.clear();
         disp.printProgStrAt(LCD_COL_START, LCD_ROW_TOP, M_NODES);
         disp.printProgStrAt(LCD_COL_START, LCD_ROW_DET, M_INPUT, LCD_LEN_OPTION);
-        disp.setCursor(-8, LCD_ROW_TOP);
 
         for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
         {
-            if (node == 8)          // If there are more than 8 inputs, show them on the second row.
+            if ((node & 7) == 0)    // Eight inputs to a row, on the top two rows.
             {
-                disp.setCursor(-8, LCD_ROW_DET);
+                if (   (node > 0)
+                    && ((node & 15) == 0))
+                {
+                    buttons.waitForButtonClick();
+                }
+                disp.setCursor(-8, (node & 8) ? LCD_ROW_DET : LCD_ROW_TOP);
             }
             
-            if (disp.getLcdId() == (I2C_INPUT_BASE_ID + node))
+            if (disp.getLcdId() == lowByte(i2cComms.inputId(node)))
             {
                 disp.printCh(CHAR_HASH);
             }
@@ -527,6 +644,142 @@ class Controller
                 outputCtl.readOutputStates(node);     // Automatically marked as present if it responds.
             }
         }
+
+        // Now the nodes in use are known, number any new modules (only on I2C, see COMMS_ENUM_START).
+        if (   (I2C_ENUM_ID > 0)
+            && (!COMMS_RS485))
+        {
+            enumerateOutputs();
+        }
+    }
+
+
+    /** Give node numbers to any unassigned Output modules.
+     *  Each is given the next free node number (on its multiplexer segment, if there are any).
+     */
+    void enumerateOutputs()
+    {
+        uint8_t span = (I2C_MUX_MAX > 0) ? (1 << I2C_SEGMENT_SHIFT) : OUTPUT_NODE_MAX;
+
+        for (uint8_t first = 0; first < OUTPUT_NODE_MAX; first += span)
+        {
+            uint8_t node = first;
+
+            while (i2cComms.exists(i2cComms.enumId(first)))
+            {
+                // Find the next free node number.
+                while (   (node < first + span)
+                       && (   (outputCtl.isOutputNodePresent(node))
+                           || (i2cComms.exists(i2cComms.outputId(node)))))
+                {
+                    node += 1;
+                }
+
+                if (node >= first + span)
+                {
+                    systemFail(M_RENUMBER, I2C_ENUM_ID);
+                    break;
+                }
+
+                if (!assignOutput(node))
+                {
+                    systemFail(M_RENUMBER, node);
+                    break;
+                }
+
+                outputCtl.readOutputStates(node);           // Automatically marked as present if it responds.
+
+                if (isDebug(DEBUG_BRIEF))
+                {
+                    Serial.print(PGMT(M_DEBUG_ASSIGN));
+                    Serial.print(PGMT(M_DEBUG_NODE));
+                    Serial.print(node, HEX);
+                    Serial.println();
+                }
+            }
+        }
+    }
+
+
+    /** Give one unassigned Output module a node number.
+     *  If two modules took it (they had the same unique ID), release them and try again with new IDs.
+     *  Return true if a module (alone) took the node number.
+     */
+    bool assignOutput(uint8_t aNode)
+    {
+        for (uint8_t attempt = 0; attempt < COMMS_ENUM_RETRIES; attempt++)
+        {
+            if (!singleOutput(aNode))
+            {
+                return false;
+            }
+
+            if (isOutputAlone(aNode))
+            {
+                return true;
+            }
+
+            i2cComms.sendData(i2cComms.outputId(aNode), COMMS_CMD_SYSTEM | COMMS_SYS_ENUMERATE, COMMS_ENUM_RELEASE, 0);
+        }
+
+        return false;
+    }
+
+
+    /** Single out one unassigned Output module and give it a node number.
+     *  Candidates vote on each bit of their unique ID (the bus ANDs their votes), dropping out
+     *  whenever another candidate has a zero where they have a one, until only one remains.
+     *  Return true if a module took the node number.
+     */
+    bool singleOutput(uint8_t aNode)
+    {
+        uint16_t id   = i2cComms.enumId(aNode);
+        int      vote = COMMS_ENUM_NONE;
+
+        if (i2cComms.sendData(id, COMMS_CMD_SYSTEM | COMMS_SYS_ENUMERATE, COMMS_ENUM_START, 0) != 0)
+        {
+            return false;
+        }
+
+        delay(COMMS_ENUM_DELAY);                // Candidates pick new unique IDs.
+
+        for (uint8_t bit = 0; bit < COMMS_ENUM_BITS; bit++)
+        {
+            if (   (i2cComms.sendData(id, COMMS_CMD_SYSTEM | COMMS_SYS_ENUMERATE, COMMS_ENUM_VOTE, bit) != 0)
+                || ((vote = i2cComms.requestByte(id)) < 0))
+            {
+                return false;
+            }
+
+            if (   (vote == COMMS_ENUM_ZERO)
+                && (i2cComms.sendData(id, COMMS_CMD_SYSTEM | COMMS_SYS_ENUMERATE, COMMS_ENUM_DROP, bit) != 0))
+            {
+                return false;
+            }
+        }
+
+        return    (i2cComms.sendData(id, COMMS_CMD_SYSTEM | COMMS_SYS_ENUMERATE, COMMS_ENUM_ASSIGN, aNode) == 0)
+               && (i2cComms.requestByte(id) == aNode);
+    }
+
+
+    /** Check that only one Output module took a node number.
+     *  It answers with a random check byte and its complement. If two modules answer,
+     *  the bus ANDs their bytes, and (unless their check bytes are the same too) they're no longer complements.
+     */
+    bool isOutputAlone(uint8_t aNode)
+    {
+        uint16_t id    = i2cComms.outputId(aNode);
+        uint8_t  check = 0;
+
+        if (   (i2cComms.sendData(id, COMMS_CMD_SYSTEM | COMMS_SYS_ENUMERATE, COMMS_ENUM_CHECK, 0) != 0)
+            || (!i2cComms.requestPacket(id, COMMS_ENUM_CHECK_LEN)))
+        {
+            return false;
+        }
+
+        check = i2cComms.readByte();
+        return check == (uint8_t)~i2cComms.readByte();
     }
 
 
@@ -536,14 +789,10 @@ class Controller
     void dispOutputHardware()
     {
         disp.printProgStrAt(LCD_COL_START, LCD_ROW_DET, M_OUTPUT, LCD_LEN_OPTION);
-        disp.setCursor(-OUTPUT_NODE_HALF, LCD_ROW_EDT);
 
         for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
         {
-            if (node == OUTPUT_NODE_HALF)
-            {
-                disp.setCursor(-OUTPUT_NODE_HALF, LCD_ROW_BOT);
-            }
+            dispNodeMapAt(node);
 
             if (outputCtl.isOutputNodePresent(node))
             {
@@ -577,7 +826,7 @@ class Controller
     {
         uint16_t value = inputState[aNode];   // Pretend no change in case of comms error.
 
-        int error = i2cComms.sendShort(I2C_INPUT_BASE_ID + aNode, MCP_GPIOA);
+        int error = i2cComms.sendShort(i2cComms.inputId(aNode), MCP_GPIOA);
         if (error)
         {
             if (isDebug(DEBUG_ERRORS))
@@ -589,13 +838,13 @@ class Controller
             }
             recordInputError(aNode);
         }
-        else if (!i2cComms.requestPacket(I2C_INPUT_BASE_ID + aNode, INPUT_STATE_LEN))
+        else if (!i2cComms.requestPacket(i2cComms.inputId(aNode), INPUT_STATE_LEN))
         {
             if (isDebug(DEBUG_ERRORS))
             {
                 Serial.print(PGMT(M_INPUT));
                 Serial.print(PGMT(M_DEBUG_LEN));
-                Serial.print(Wire.available());
+                Serial.print(i2cComms.available());
                 Serial.println();
             }
             recordInputError(aNode);
@@ -605,8 +854,8 @@ class Controller
             value = i2cComms.readWord();
         }
 
-        // if (   (i2cComms.sendShort(I2C_INPUT_BASE_ID + aNode, MCP_GPIOA))
-        //     || (!i2cComms.requestPacket(I2C_INPUT_BASE_ID + aNode, INPUT_STATE_LEN)))
+        // if (   (i2cComms.sendShort(i2cComms.inputId(aNode), MCP_GPIOA))
+        //     || (!i2cComms.requestPacket(i2cComms.inputId(aNode), INPUT_STATE_LEN)))
         // {
         //     recordInputError(aNode);
         // }
@@ -689,48 +938,44 @@ class Controller
     }
 
 
-    /** See if there's a Gateway request.
-     *  Process the request.
-     *  Return true if work done.
+    /** Does the Gateway have requests waiting?
+     *  Either it's holding the attention pin low, or it's rung the doorbell.
+     *  An RS-485 Gateway can't ring, so without the attention pin it's polled every STEP_GATEWAY.
+     */
+    bool isGatewayWaiting(unsigned long aNow)
+    {
+        if (GATEWAY_ATTENTION_PIN > 0)
+        {
+            return digitalRead(GATEWAY_ATTENTION_PIN) == LOW;
+        }
+
+        if (   (COMMS_RS485)
+            && (aNow > tickGateway))
+        {
+            tickGateway = aNow + STEP_GATEWAY;
+            return true;
+        }
+
+        return gatewayAttention;
+    }
+
+
+    /** Collect the Gateway's requests.
+     *  Process a batch of requests (see COMMS_GATEWAY_BATCH).
+     *  Return true if the Gateway has more requests queued.
      */
     bool gatewayRequest()
     {
-        bool workDone = false;
+        uint8_t count = 0;
+        uint8_t batch[COMMS_GATEWAY_BATCH * 2];
     
         i2cComms.sendGateway(COMMS_CMD_SYSTEM | COMMS_SYS_GATEWAY, -1, -1);
         if (i2cComms.requestGateway())
         {
-            uint8_t command = i2cComms.readByte();
-            uint8_t node    = i2cComms.readByte();
-            uint8_t option  = command & COMMS_OPTION_MASK;
-            // uint8_t pin     = option & OUTPUT_PIN_MASK;
-    
-            command &= COMMS_COMMAND_MASK;
-    
-            switch (command)
-            {
-                case COMMS_CMD_SYSTEM: if (option == COMMS_SYS_OUT_STATES)
-                                       {
-                                           i2cComms.sendGateway(COMMS_CMD_SYSTEM | COMMS_SYS_OUT_STATES, outputCtl.getOutputStates(node), -1);
-                                           workDone = true;
-                                       }
-                                       else if (option == COMMS_SYS_INP_STATES)
-                                       {
-                                           i2cComms.sendGateway(COMMS_CMD_SYSTEM | COMMS_SYS_INP_STATES,
-                                                                (getInputState(node) >> 8) & 0xFF,
-                                                                (getInputState(node)     ) & 0xFF);
-                                           workDone = true;
-                                       }
-                                       else
-                                       {
-                                           systemFail(M_GATEWAY, command | option);
-                                       }
-                                       break;
-    
-                case COMMS_CMD_NONE:   break;
-    
-                default:               systemFail(M_GATEWAY, command | option);
-                                       break;
+            count = i2cComms.readByte();
+            for (uint8_t index = 0; index < sizeof(batch); index++)
+            {
+                batch[index] = i2cComms.readByte();
             }
         }
     //    else
@@ -740,8 +985,107 @@ class Controller
     //    }
     
         i2cComms.readAll();
+
+        // Process the requests after reading them, replies are sent to the Gateway.
+        for (uint8_t index = 0; index < min(count & COMMS_GATEWAY_COUNT, COMMS_GATEWAY_BATCH); index++)
+        {
+            gatewayCommand(batch[index * 2], batch[index * 2 + 1]);
+        }
     
-        return workDone;
+        return (count & COMMS_GATEWAY_MORE) != 0;
+    }
+
+
+    /** Send the Gateway the states of nodes that have changed since they were last sent.
+     *  As many as fit in one message, the rest are sent next time.
+     */
+    void gatewayChanges()
+    {
+        uint8_t data[COMMS_CHANGES_MAX];
+        uint8_t len = COMMS_CHANGES_MASKS;
+
+        memset(data, 0, COMMS_CHANGES_MASKS);
+
+        for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+        {
+            if (   (gatewayOutputs & ((OutputNodes)1 << node))
+                && (len + 1 <= COMMS_CHANGES_MAX))
+            {
+                gatewayOutputs   &= ~((OutputNodes)1 << node);
+                data[node >> 3]  |= 1 << (node & 7);
+                data[len++]       = outputCtl.getOutputStates(node);
+            }
+        }
+
+        for (uint8_t node = 0; node < INPUT_NODE_MAX; node++)
+        {
+            if (   (gatewayInputs & ((InputNodes)1 << node))
+                && (len + 2 <= COMMS_CHANGES_MAX))
+            {
+                gatewayInputs                             &= ~((InputNodes)1 << node);
+                data[COMMS_CHANGES_OUTPUTS + (node >> 3)] |= 1 << (node & 7);
+                data[len++]                                = (getInputState(node) >> 8) & 0xFF;
+                data[len++]                                = (getInputState(node)     ) & 0xFF;
+            }
+        }
+
+        i2cComms.sendGatewayBuffer(COMMS_CMD_SYSTEM | COMMS_SYS_CHANGES, data, len);
+    }
+
+
+    /** Process a Gateway request.
+     */
+    void gatewayCommand(uint8_t aCommand, uint8_t aNode)
+    {
+        uint8_t command = aCommand & COMMS_COMMAND_MASK;
+        uint8_t option  = aCommand & COMMS_OPTION_MASK;
+        uint8_t pin     = option   & OUTPUT_PIN_MASK;
+
+        switch (command)
+        {
+            case COMMS_CMD_SYSTEM: if (   (option == COMMS_SYS_OUT_STATES)
+                                       && (aNode  < OUTPUT_NODE_MAX))
+                                   {
+                                       i2cComms.sendGateway(COMMS_CMD_SYSTEM | COMMS_SYS_OUT_STATES, aNode, outputCtl.getOutputStates(aNode));
+                                   }
+                                   else if (option == COMMS_SYS_SNAPSHOT)
+                                   {
+                                       gatewaySnapshot();
+                                   }
+                                   else if (   (option == COMMS_SYS_INP_STATES)
+                                            && (aNode  < INPUT_NODE_MAX))
+                                   {
+                                       uint8_t data[] = { aNode,
+                                                          (uint8_t)((getInputState(aNode) >> 8) & 0xFF),
+                                                          (uint8_t)((getInputState(aNode)     ) & 0xFF) };
+                                       i2cComms.sendGatewayBuffer(COMMS_CMD_SYSTEM | COMMS_SYS_INP_STATES, data, sizeof(data));
+                                   }
+                                   else
+                                   {
+                                       systemFail(M_GATEWAY, aCommand);
+                                   }
+                                   break;
+
+            case COMMS_CMD_SET_LO:
+            case COMMS_CMD_SET_HI: if (aNode < OUTPUT_NODE_MAX)
+                                   {
+                                       processOutput(aNode, pin, command == COMMS_CMD_SET_HI, 0);
+                                   }
+                                   break;
+
+            case COMMS_CMD_INP_LO:
+            case COMMS_CMD_INP_HI: if (   (aNode < INPUT_NODE_MAX)
+                                       && (option < INPUT_PIN_MAX))
+                                   {
+                                       processInput(aNode, option, command == COMMS_CMD_INP_HI);
+                                   }
+                                   break;
+
+            case COMMS_CMD_NONE:   break;
+
+            default:               systemFail(M_GATEWAY, aCommand);
+                                   break;
+        }
     }
 };
 
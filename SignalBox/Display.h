@@ -344,11 +344,11 @@ class Display
 
 
     /** Print a HEX character.
-     *  Note that this can print 'hex' characters 'G' to 'V' also.
+     *  Note that this can print 'hex' characters 'G' to 'V' also (and beyond, with wide node numbers).
      */
     void printHexCh(uint8_t aHexValue)
     {
-        printCh(HEX_CHARS[aHexValue & 0x1f]);
+        printCh(HEX_CHARS[aHexValue & HEX_MASK]);
     }
 
 
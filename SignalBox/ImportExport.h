@@ -8,6 +8,23 @@
  *      http://creativecommons.org/licenses/by-nc-sa/4.0/
  *
  *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Configuration is exported and imported as tab-separated text (see db/Layout.txt), or as a binary backup.
+ *  Both walk the same Inputs and Outputs, loaded and saved the same way, they differ only in the encoding.
+ *
+ *  Binary backup (Export "Backup", recognised by Import from its first byte):
+ *      Header      BACKUP_MAGIC, BACKUP_VERSION, Input count (2 bytes, low first), Input record length,
+ *                  Output count (2 bytes, low first), Output record length.
+ *      Records     All the Input records, then all the Output records.
+ *          Input   BACKUP_INPUT,  Node, Pin, Type, then the InputDef as held in EEPROM.
+ *          Output  BACKUP_OUTPUT, Node, Pin, then the OutputDef in its wire format (including its locks).
+ *  The header and each record are followed by the CRC (CCITT, high byte first) of everything so far.
+ *
+ *  When importing, the header and each record are answered by IMPORT_READY when accepted, or
+ *  IMPORT_RETRY then IMPORT_READY when they fail their CRC (or a record's tag is unknown) and must be sent again.
+ *  Before IMPORT_RETRY, the rest of the rejected block is discarded, up to a pause of BACKUP_QUIET.
+ *  A record is only saved once its CRC is checked.
  */
 
 #ifndef ImportExport_h
@@ -17,13 +34,35 @@
 // Import word buffer.
 const uint8_t WORD_BUFFER_LENGTH = 32;
 
+// Import flow control.
+const uint8_t IMPORT_READY       = 0x11;        // XON, sent when ready for the next line.
+const uint8_t IMPORT_RETRY       = 0x15;        // NAK, binary header or record rejected.
+
+// Binary backup.
+const uint8_t  BACKUP_MAGIC      = 0xB5;        // First byte of a backup, never starts a text line.
+const uint8_t  BACKUP_VERSION    = 1;           // Format version.
+const uint8_t  BACKUP_HEADER_LEN = 8;           // Length of the header.
+const uint8_t  BACKUP_INPUT      = 'I';         // Input record tag.
+const uint8_t  BACKUP_OUTPUT     = 'O';         // Output record tag.
+const uint8_t  BACKUP_INPUT_LEN  = 4 + INPUT_SIZE;                  // Tag, node, pin, type and InputDef.
+const uint8_t  BACKUP_OUTPUT_LEN = 3 + OUTPUT_DEF_LEN;              // Tag, node, pin and OutputDef.
+const uint8_t  BACKUP_RECORD_MAX = (BACKUP_INPUT_LEN > BACKUP_OUTPUT_LEN) ? BACKUP_INPUT_LEN : BACKUP_OUTPUT_LEN;
+const uint16_t BACKUP_CRC_INIT   = 0xFFFF;      // CRC-16/CCITT initial value.
+const uint16_t BACKUP_CRC_POLY   = 0x1021;      // CRC-16/CCITT polynomial.
+const uint8_t  BACKUP_QUIET      = 10;          // Time (msecs) without a byte that ends a rejected block.
+
+#if SERIAL_FRAMED
+static_assert(BACKUP_RECORD_MAX + 2 <= MUX_BUFFER_LEN, "A backup record and its CRC don't fit the config channel");
+#endif
+
 // Export menu states.
 const uint8_t EXP_ALL            =  0;
 const uint8_t EXP_SYSTEM         =  1;
 const uint8_t EXP_INPUTS         =  2;
 const uint8_t EXP_OUTPUTS        =  3;
 const uint8_t EXP_LOCKS          =  4;
-const uint8_t EXP_MAX            =  5;
+const uint8_t EXP_BACKUP         =  5;
+const uint8_t EXP_MAX            =  6;
 
 
 /** An Importer/exporter.
@@ -32,49 +71,72 @@ class ImportExport
 {
     private:
 
+    Stream& stream;                             // Stream to import from and export to.
     int  lastChar;                              // Last character read.
     char wordBuffer[WORD_BUFFER_LENGTH + 1];    // Buffer to read characters with null terminator on the end.
     unsigned long messageTick = 1L;             // Time the last message was emitted.
+    unsigned long promptTick  = 0L;             // Time to repeat the ready prompt, zero if not waiting for a line.
+    bool abandoned = false;                     // Import abandoned by a button press.
+    uint16_t crc = BACKUP_CRC_INIT;             // Running CRC of a binary backup.
 
 
     public:
 
-    /** An ImportExport object.
+    /** An ImportExport object using the given Stream.
      */
-    ImportExport()
+    ImportExport(Stream& aStream):
+                 stream(aStream)
     {
     }
 
 
-    /** Import configuration from Serial line.
+    /** Import configuration from the stream.
+     *  Sends IMPORT_READY each time it's ready for a line, so the sender can go as fast as the lines are processed.
      */
     void doImport()
     {
-        int len = 0;
-
         messageTick = 1;            // Ensure "waiting" message appears.
+        abandoned   = false;
         buttons.waitForButtonRelease();
+#if SERIAL_FRAMED
+        configChannel.listen(true);         // Keep the config channel's frames.
+#endif
 
         // Clear the buffer
-        while (Serial.available())
+        while (stream.available())
         {
-            Serial.read();
+            stream.read();
         }
 
         // Keep going until until button pressed.
-        while (   ((len = readWord()) >= 0)
-               && (!buttons.readButton()))
+        while (!abandoned)
         {
-            if (   (len > 0)
-                && (wordBuffer[0] != CHAR_HASH))
+            prompt();                           // Ready for the next line.
+
+            if (   (waitChar())
+                && (stream.peek() == BACKUP_MAGIC))
+            {
+                importBackup();
+            }
+            else
             {
-                importLine();
-                messageTick = millis() + DELAY_READ;
+                if (   (readWord() > 0)
+                    && (!abandoned)
+                    && (wordBuffer[0] != CHAR_HASH))
+                {
+                    importLine();
+                }
+
+                // Skip rest of line.
+                skipLine();
             }
 
-            // Skip rest of line.
-            skipLine();
+            messageTick = millis() + DELAY_READ;
         }
+
+#if SERIAL_FRAMED
+        configChannel.listen(false);
+#endif
     }
 
 
@@ -82,7 +144,8 @@ class ImportExport
      */
     void doExport(int aExport)
     {
-        uint8_t debugLevel = systemMgr.getDebugLevel();
+        uint8_t     debugLevel = systemMgr.getDebugLevel();
+        OutputNodes locked     = ~(OutputNodes)0;   // Output nodes that may have locks, until exportOutputs() has looked.
 
         disp.printProgStrAt(-strlen_P(M_EXPORTING), LCD_ROW_DET, M_EXPORTING);
         systemMgr.setDebugLevel(DEBUG_NONE);
@@ -90,27 +153,31 @@ class ImportExport
         switch(aExport)
         {
             case EXP_ALL:     exportSystem(debugLevel);
-                              exportInputs(true);
-                              exportOutputs();
-                              exportLocks();
+                              exportInputs(true, false);
+                              locked = exportOutputs(false);
+                              exportLocks(locked);
                               break;
 
             case EXP_SYSTEM:  exportSystem(debugLevel);
                               break;
 
-            case EXP_INPUTS:  exportInputs(false);
+            case EXP_INPUTS:  exportInputs(false, false);
+                              break;
+
+            case EXP_OUTPUTS: exportOutputs(false);
                               break;
 
-            case EXP_OUTPUTS: exportOutputs();
+            case EXP_LOCKS:   exportLocks(locked);
                               break;
 
-            case EXP_LOCKS:   exportLocks();
+            case EXP_BACKUP:  exportBackup();
                               break;
 
             default:          systemFail(M_EXPORT, aExport);
                               break;
         }
 
+        stream.flush();
         disp.clearRow(-strlen_P(M_EXPORTING), LCD_ROW_DET);
         systemMgr.setDebugLevel(debugLevel);
     }
@@ -118,6 +185,17 @@ class ImportExport
 
     private:
 
+    /** Tell the sender we're ready for the next line.
+     *  Repeated every DELAY_READ until it starts, in case the prompt is missed.
+     */
+    void prompt()
+    {
+        stream.write(IMPORT_READY);
+        stream.flush();
+        promptTick = millis() + DELAY_READ;
+    }
+
+
     /** Import a line.
      */
     void importLine()
@@ -168,8 +246,14 @@ class ImportExport
         int node = 0;
         int pin  = 0;
 
-        node = readData() & INPUT_NODE_MASK;
+        node = readNode();
         pin  = readData() & INPUT_PIN_MASK;
+        if (   (node < 0)
+            || (node >= INPUT_NODE_MAX))
+        {
+            importError();
+            return;
+        }
         inputMgr.loadInput(node, pin);
 
         // Read the Input's type.
@@ -191,7 +275,7 @@ class ImportExport
             // Read all the Input's Outputs.
             for (int index = 0; index < INPUT_OUTPUT_MAX; index++)
             {
-                int outNode = readData();
+                int outNode = readNode();
                 int outPin  = readData();
                 boolean outDelay = outNode < 0;
                 
@@ -213,11 +297,19 @@ class ImportExport
             disp.printProgStrAt(LCD_COL_START, LCD_ROW_DET, M_INPUT_TYPES[inputType], LCD_LEN_STATUS);
             disp.printHexChAt(LCD_COL_NODE, LCD_ROW_DET, node);
             disp.printHexChAt(LCD_COL_PIN , LCD_ROW_DET, pin);
-            inputMgr.saveInput();
+            storeInput();
         }
     }
 
 
+    /** Save an imported Input (in inputDef and inputType).
+     */
+    void storeInput()
+    {
+        inputMgr.saveInput();
+    }
+
+
     /** Import an output
      */
     void importOutput()
@@ -225,7 +317,7 @@ class ImportExport
         uint8_t type  = 0;
         int     value = 0;
 
-        outputNode = readData() & OUTPUT_NODE_MASK;
+        outputNode = readNode() & OUTPUT_NODE_MASK;
         outputPin  = readData() & OUTPUT_PIN_MASK;
 
         // Read the Output's type.
@@ -277,19 +369,27 @@ class ImportExport
             disp.printHexChAt(LCD_COL_NODE,  LCD_ROW_DET, outputNode);
             disp.printHexChAt(LCD_COL_PIN ,  LCD_ROW_DET, outputPin);
 
-            outputCtl.writeOutput();
-            outputCtl.writeSaveOutput();
+            storeOutput();
         }
     }
 
 
+    /** Save an imported Output (in outputDef) to its module.
+     */
+    void storeOutput()
+    {
+        outputCtl.writeOutput();
+        outputCtl.writeSaveOutput();
+    }
+
+
     /** Import a lock
      */
     void importLock()
     {
         int value = 0;
 
-        outputNode = readData() & OUTPUT_NODE_MASK;
+        outputNode = readNode() & OUTPUT_NODE_MASK;
         outputPin  = readData() & OUTPUT_PIN_MASK;
 
         disp.printProgStrAt(LCD_COLS - LCD_LEN_OPTION, LCD_ROW_TOP, M_LOCK, LCD_LEN_OPTION);
@@ -317,7 +417,7 @@ class ImportExport
                     else
                     {
                         outputDef.setLockState(hi, index, !strcmp_P(wordBuffer, M_HI));
-                        value = readData();
+                        value = readNode();
                         if (value < 0)
                         {
                             outputDef.setLock(hi, index, false);
@@ -332,8 +432,7 @@ class ImportExport
                 }
             }
 
-            outputCtl.writeOutput();
-            outputCtl.writeSaveOutput();
+            storeOutput();
         }
         else
         {
@@ -343,15 +442,36 @@ class ImportExport
 
 
     /** Read a character into lastChar when available.
+     */
+    int readChar()
+    {
+        waitChar();
+        return stream.read();
+    }
+
+
+    /** Wait for a character to be available.
+     *  Only check the buttons while waiting, so a line arriving at full speed doesn't overflow the receive buffer.
      *  Abandon reading if a button is pressed.
      *  Output Waiting message if we wait a long time.
+     *  Return false if abandoned.
      */
-    int readChar()
+    bool waitChar()
     {
-        while (   (!buttons.readButton())
-               && (!Serial.available()))
+        while (   (!abandoned)
+               && (!stream.available()))
         {
-            delay(DELAY_BUTTON_WAIT);
+#if SERIAL_FRAMED
+            serialMux.update();                 // Receive the next frame.
+#endif
+            abandoned = buttons.readButton() != BUTTON_NONE;
+
+            // Repeat the ready prompt if the line hasn't started.
+            if (   (promptTick > 0)
+                && (promptTick < millis()))
+            {
+                prompt();
+            }
 
             // Clear message if there's no activity.
             if (   (messageTick > 0)
@@ -364,7 +484,8 @@ class ImportExport
             }
         }
 
-        return Serial.read();
+        promptTick = 0;
+        return !abandoned;
     }
 
 
@@ -373,10 +494,30 @@ class ImportExport
      *  If dots are present, return a negative number -HEX_MAX
      */
     int readData()
+    {
+        return parseData(readWord());
+    }
+
+
+    /** Read a node number.
+     *  A single character is a node character (see charToNode()), anything longer is (hexadecimal) data.
+     *  If dots are present, return a negative number -HEX_MAX
+     */
+    int readNode()
+    {
+        int len = readWord();
+
+        return (len == 1) ? charToNode(wordBuffer[0]) : parseData(len);
+    }
+
+
+    /** Parse the (hexadecimal) data in the wordBuffer, of the given length.
+     */
+    int parseData(int aLen)
     {
         int  hex   = 0;
         int  value = 0;
-        int  len   = readWord();
+        int  len   = aLen;
 
         if (len <= 0)
         {
@@ -427,7 +568,7 @@ class ImportExport
      */
     void skipLine()
     {
-        while (   (!buttons.readButton())
+        while (   (!abandoned)
                && (!isEndOfLine()))
         {
             lastChar = readChar();
@@ -437,7 +578,7 @@ class ImportExport
     }
 
 
-    /** Read a word from the Serial.
+    /** Read a word from the stream.
      *  Don't read beyond end-of-line
      */
     int readWord()
@@ -445,13 +586,17 @@ class ImportExport
         int index = 0;
 
         // Read upto WORD_BUFFER_LENGTH characters.
-        while (   (!buttons.readButton())
+        while (   (!abandoned)
                && (!isEndOfLine())
                && (index < WORD_BUFFER_LENGTH))
         {
             lastChar = readChar();
 
-            if (isWhiteSpace())
+            if (abandoned)
+            {
+                break;
+            }
+            else if (isWhiteSpace())
             {
                 if (index == 0)
                 {
@@ -492,7 +637,217 @@ class ImportExport
         else
         {
             disp.clearRow(LCD_COL_START, LCD_ROW_DET);
+            abandoned = true;
+        }
+    }
+
+
+    /** Add a byte to a CRC-16/CCITT.
+     */
+    static uint16_t crc16(uint16_t aCrc, uint8_t aByte)
+    {
+        aCrc ^= aByte << 8;
+
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            aCrc = (aCrc & 0x8000) ? ((aCrc << 1) ^ BACKUP_CRC_POLY) : (aCrc << 1);
+        }
+
+        return aCrc;
+    }
+
+
+    /** Write a block of a binary backup, followed by the running CRC.
+     */
+    void writeBlock(uint8_t* aBuffer, uint8_t aLength)
+    {
+        for (uint8_t index = 0; index < aLength; index++)
+        {
+            crc = crc16(crc, aBuffer[index]);
+        }
+
+        stream.write(aBuffer, aLength);
+        stream.write(highByte(crc));
+        stream.write(lowByte(crc));
+    }
+
+
+    /** Read a block of a binary backup, and check the running CRC that follows it.
+     *  The block's first byte has already been read.
+     *  Return false if the CRC is wrong.
+     */
+    bool readBlock(uint8_t* aBuffer, uint8_t aLength)
+    {
+        uint16_t sum = crc16(crc, aBuffer[0]);
+
+        for (uint8_t index = 1; (index < aLength) && (!abandoned); index++)
+        {
+            aBuffer[index] = readChar();
+            sum = crc16(sum, aBuffer[index]);
+        }
+
+        uint16_t check = readChar() << 8;
+        check |= readChar() & 0xff;
+
+        if (   (abandoned)
+            || (check != sum))
+        {
+            return false;
+        }
+
+        crc = sum;
+        return true;
+    }
+
+
+    /** Reject a block of a binary backup.
+     *  Discard the rest of it, reading until nothing has arrived for BACKUP_QUIET,
+     *  so none of it is taken for the next record's tag. Then ask for it again.
+     */
+    void rejectBlock()
+    {
+        unsigned long quiet = millis();
+
+        while (millis() - quiet < BACKUP_QUIET)
+        {
+#if SERIAL_FRAMED
+            serialMux.update();                 // Receive the next frame.
+#endif
+            if (stream.available())
+            {
+                stream.read();
+                quiet = millis();
+            }
         }
+
+        stream.write(IMPORT_RETRY);
+    }
+
+
+    /** Import a binary backup.
+     *  Header, then each record, acknowledged so the sender can go as fast as they're saved.
+     */
+    void importBackup()
+    {
+        uint8_t buffer[BACKUP_RECORD_MAX > BACKUP_HEADER_LEN ? BACKUP_RECORD_MAX : BACKUP_HEADER_LEN];
+        uint16_t total = 0;
+
+        crc = BACKUP_CRC_INIT;
+        buffer[0] = readChar();
+
+        if (   (!readBlock(buffer, BACKUP_HEADER_LEN))
+            || (buffer[1] != BACKUP_VERSION)
+            || (buffer[4] != BACKUP_INPUT_LEN)
+            || (buffer[7] != BACKUP_OUTPUT_LEN))
+        {
+            rejectBlock();
+            return;
+        }
+
+        total = buffer[2] + (buffer[3] << 8) + buffer[5] + (buffer[6] << 8);
+        disp.clearRow(LCD_COL_START, LCD_ROW_DET);
+        disp.printProgStrAt(LCD_COLS - LCD_LEN_OPTION, LCD_ROW_TOP, M_BACKUP, LCD_LEN_OPTION);
+
+        for (uint16_t count = 0; (count < total) && (!abandoned); )
+        {
+            prompt();
+            buffer[0] = readChar();
+
+            uint8_t len = (buffer[0] == BACKUP_INPUT)  ? BACKUP_INPUT_LEN
+                        : (buffer[0] == BACKUP_OUTPUT) ? BACKUP_OUTPUT_LEN
+                        : 1;
+
+            if (   (len == 1)
+                || (!readBlock(buffer, len)))
+            {
+                rejectBlock();
+            }
+            else if (buffer[0] == BACKUP_INPUT)
+            {
+                if ((buffer[1] & INPUT_NODE_MASK) < INPUT_NODE_MAX)         // Not all the masked node numbers are nodes.
+                {
+                    inputMgr.loadInput(buffer[1] & INPUT_NODE_MASK, buffer[2] & INPUT_PIN_MASK);
+                    inputType = buffer[3] & INPUT_TYPE_MASK;
+                    memcpy(&inputDef, buffer + 4, INPUT_SIZE);
+                    storeInput();
+                }
+                count += 1;
+            }
+            else
+            {
+                outputNode = buffer[1] & OUTPUT_NODE_MASK;
+                outputPin  = buffer[2] & OUTPUT_PIN_MASK;
+                outputDef.wire(buffer + 3, false);
+                outputDef.setState(outputCtl.getOutputState(outputNode, outputPin));
+                storeOutput();
+                count += 1;
+            }
+        }
+
+        disp.printProgStrAt(LCD_COL_START, LCD_ROW_DET, abandoned ? M_NONE : M_ALL, LCD_LEN_STATUS);
+    }
+
+
+    /** Export everything as a binary backup.
+     *  All the Inputs, and the Outputs of the Output nodes present.
+     */
+    void exportBackup()
+    {
+        uint8_t  header[BACKUP_HEADER_LEN];
+        uint16_t outputs = 0;
+
+        for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+        {
+            if (outputCtl.isOutputNodePresent(node))
+            {
+                outputs += OUTPUT_PIN_MAX;
+            }
+        }
+
+        crc = BACKUP_CRC_INIT;
+        header[0] = BACKUP_MAGIC;
+        header[1] = BACKUP_VERSION;
+        header[2] = lowByte(INPUT_MAX);
+        header[3] = highByte(INPUT_MAX);
+        header[4] = BACKUP_INPUT_LEN;
+        header[5] = lowByte(outputs);
+        header[6] = highByte(outputs);
+        header[7] = BACKUP_OUTPUT_LEN;
+        writeBlock(header, BACKUP_HEADER_LEN);
+
+        exportInputs(true, true);
+        exportOutputs(true);
+    }
+
+
+    /** Write the current Input (in inputDef and inputType) as a backup record.
+     */
+    void writeInputRecord(uint8_t aNode, uint8_t aPin)
+    {
+        uint8_t record[BACKUP_INPUT_LEN];
+
+        record[0] = BACKUP_INPUT;
+        record[1] = aNode;
+        record[2] = aPin;
+        record[3] = inputType;
+        memcpy(record + 4, &inputDef, INPUT_SIZE);
+
+        writeBlock(record, BACKUP_INPUT_LEN);
+    }
+
+
+    /** Write the current Output (in outputDef) as a backup record.
+     */
+    void writeOutputRecord(uint8_t aNode, uint8_t aPin)
+    {
+        uint8_t record[BACKUP_OUTPUT_LEN];
+
+        record[0] = BACKUP_OUTPUT;
+        record[1] = aNode;
+        record[2] = aPin;
+        outputDef.wire(record + 3, true);
+
+        writeBlock(record, BACKUP_OUTPUT_LEN);
     }
 
 
@@ -501,18 +856,18 @@ class ImportExport
     void exportSystem(uint8_t aDebugLevel)
     {
         // Export header comment.
-        Serial.println(PGMT(M_EXPORT_SYSTEM));
+        stream.println(PGMT(M_EXPORT_SYSTEM));
 
         // Export system definition.
-        Serial.print(PGMT(M_SYSTEM));
-        Serial.print(CHAR_TAB);
-        Serial.print(PGMT(M_VERSION));
-        Serial.print(CHAR_TAB);
-        Serial.print(PGMT(M_REPORT_PROMPTS[systemMgr.getReportLevel()]));
-        Serial.print(CHAR_TAB);
-        Serial.print(PGMT(M_DEBUG_PROMPTS[aDebugLevel]));
-        Serial.println();
-        Serial.println();
+        stream.print(PGMT(M_SYSTEM));
+        stream.print(CHAR_TAB);
+        stream.print(PGMT(M_VERSION));
+        stream.print(CHAR_TAB);
+        stream.print(PGMT(M_REPORT_PROMPTS[systemMgr.getReportLevel()]));
+        stream.print(CHAR_TAB);
+        stream.print(PGMT(M_DEBUG_PROMPTS[aDebugLevel]));
+        stream.println();
+        stream.println();
 
 //        if (aDebugLevel >= DEBUG_FULL)
 //        {
@@ -521,19 +876,22 @@ class ImportExport
     }
 
 
-    /** Export the Inputs.
+    /** Export the Inputs, as text or backup records.
      *  Only export connected inputs, unless aAll is set.
      */
-    void exportInputs(bool aAll)
+    void exportInputs(bool aAll, bool aBackup)
     {
         // Export header comment
-        Serial.print(PGMT(M_EXPORT_INPUT));
-        for (uint8_t index = 0; index < INPUT_OUTPUT_MAX; index++)
+        if (!aBackup)
         {
-            Serial.print(PGMT(M_EXPORT_INPUT_OUT));
-            Serial.print(OPTION_ID(index));
+            stream.print(PGMT(M_EXPORT_INPUT));
+            for (uint8_t index = 0; index < INPUT_OUTPUT_MAX; index++)
+            {
+                stream.print(PGMT(M_EXPORT_INPUT_OUT));
+                stream.print(OPTION_ID(index));
+            }
+            stream.println();
         }
-        Serial.println();
 
         // Export all the inputs
         for (int node = 0; node < INPUT_NODE_MAX; node++)
@@ -546,121 +904,189 @@ class ImportExport
                     // Export Input defintion
                     inputMgr.loadInput(node, pin);
 
-                    Serial.print(PGMT(M_INPUT));
-                    Serial.print(CHAR_TAB);
-                    Serial.print(HEX_CHARS[node]);
-                    Serial.print(CHAR_TAB);
-                    Serial.print(HEX_CHARS[pin]);
-                    Serial.print(CHAR_TAB);
-                    Serial.print(PGMT(M_INPUT_TYPES[inputType]));
-
-                    // Export Input's Outputs.
-                    for (int index = 0; index < INPUT_OUTPUT_MAX; index++)
+                    if (aBackup)
                     {
-                        Serial.print(CHAR_TAB);
-                        if (inputDef.isDelay(index))
-                        {
-                            Serial.print(CHAR_DOT);
-                            Serial.print(CHAR_SPACE);
-                            if (inputDef.getOutputPin(index) == 0)
-                            {
-                                Serial.print(CHAR_DOT);
-                            }
-                            else
-                            {
-                                Serial.print(HEX_CHARS[inputDef.getOutputPin(index)]);
-                            }
-                        }
-                        else
-                        {
-                            Serial.print(HEX_CHARS[inputDef.getOutputNode(index)]);
-                            Serial.print(CHAR_SPACE);
-                            Serial.print(HEX_CHARS[inputDef.getOutputPin(index)]);
-                        }
+                        writeInputRecord(node, pin);
+                    }
+                    else
+                    {
+                        printInput(node, pin);
                     }
-                    Serial.println();
                 }
-                Serial.println();
+
+                if (!aBackup)
+                {
+                    stream.println();
+                }
+            }
+        }
+    }
+
+
+    /** Print the current Input (in inputDef and inputType).
+     */
+    void printInput(uint8_t aNode, uint8_t aPin)
+    {
+        stream.print(PGMT(M_INPUT));
+        stream.print(CHAR_TAB);
+        stream.print(HEX_CHARS[aNode]);
+        stream.print(CHAR_TAB);
+        stream.print(HEX_CHARS[aPin]);
+        stream.print(CHAR_TAB);
+        stream.print(PGMT(M_INPUT_TYPES[inputType]));
+
+        // Export Input's Outputs.
+        for (int index = 0; index < INPUT_OUTPUT_MAX; index++)
+        {
+            stream.print(CHAR_TAB);
+            if (inputDef.isDelay(index))
+            {
+                stream.print(CHAR_DOT);
+                stream.print(CHAR_SPACE);
+                if (inputDef.getOutputPin(index) == 0)
+                {
+                    stream.print(CHAR_DOT);
+                }
+                else
+                {
+                    stream.print(HEX_CHARS[inputDef.getOutputPin(index)]);
+                }
+            }
+            else
+            {
+                stream.print(HEX_CHARS[inputDef.getOutputNode(index)]);
+                stream.print(CHAR_SPACE);
+                stream.print(HEX_CHARS[inputDef.getOutputPin(index)]);
             }
         }
+        stream.println();
     }
 
 
-    /** Export the Outputs.
+    /** Export the Outputs, as text or backup records.
+     *  Return the Output nodes that have locks.
      */
-    void exportOutputs()
+    OutputNodes exportOutputs(bool aBackup)
     {
+        OutputNodes locked = 0;
+
         // Export header comment.
-        Serial.print(PGMT(M_EXPORT_OUTPUT));
-        Serial.println();
+        if (!aBackup)
+        {
+            stream.print(PGMT(M_EXPORT_OUTPUT));
+            stream.println();
+        }
 
         // Export all the Outputs.
         for (int node = 0; node < OUTPUT_NODE_MAX; node++)
         {
             if (outputCtl.isOutputNodePresent(node))
             {
+                outputCtl.readOutputNode(node);
+
                 for (int pin = 0; pin < OUTPUT_PIN_MAX; pin++)
                 {
                     // Export Output definition.
-                    outputCtl.readOutput(node, pin);
-
-                    Serial.print(PGMT(M_OUTPUT));
-                    Serial.print(CHAR_TAB);
-                    Serial.print(HEX_CHARS[node]);
-                    Serial.print(CHAR_TAB);
-                    Serial.print(HEX_CHARS[pin]);
-                    Serial.print(CHAR_TAB);
-                    Serial.print(PGMT(M_OUTPUT_TYPES[outputDef.getType()]));
-                    Serial.print(CHAR_TAB);
-                    printHex(outputDef.getLo(),    2);
-                    Serial.print(CHAR_TAB);
-                    printHex(outputDef.getHi(),    2);
-                    Serial.print(CHAR_TAB);
-                    printHex(outputDef.getPace(),  2);
-                    Serial.print(CHAR_TAB);
-                    printHex(outputDef.getReset(), 2);
-                    Serial.println();
+                    outputCtl.loadOutput(node, pin);
+
+                    if (outputDef.isLocked())
+                    {
+                        locked |= (OutputNodes)1 << node;
+                    }
+
+                    if (aBackup)
+                    {
+                        writeOutputRecord(node, pin);
+                    }
+                    else
+                    {
+                        printOutput(node, pin);
+                    }
+                }
+
+                if (!aBackup)
+                {
+                    stream.println();
                 }
-                Serial.println();
             }
         }
+
+        return locked;
+    }
+
+
+    /** Print the current Output (in outputDef).
+     */
+    void printOutput(uint8_t aNode, uint8_t aPin)
+    {
+        stream.print(PGMT(M_OUTPUT));
+        stream.print(CHAR_TAB);
+        stream.print(HEX_CHARS[aNode]);
+        stream.print(CHAR_TAB);
+        stream.print(HEX_CHARS[aPin]);
+        stream.print(CHAR_TAB);
+        stream.print(PGMT(M_OUTPUT_TYPES[outputDef.getType()]));
+        stream.print(CHAR_TAB);
+        printHex(outputDef.getLo(),    2);
+        stream.print(CHAR_TAB);
+        printHex(outputDef.getHi(),    2);
+        stream.print(CHAR_TAB);
+        printHex(outputDef.getPace(),  2);
+        stream.print(CHAR_TAB);
+        printHex(outputDef.getReset(), 2);
+        stream.println();
     }
 
 
     /** Export the defined locks.
+     *  Only the nodes in aLocked are read from their OutputModules, the others are known to have no locks.
      */
-    void exportLocks()
+    void exportLocks(OutputNodes aLocked)
     {
         // Export header comment.
-        Serial.print(PGMT(M_EXPORT_LOCKS));
+        stream.print(PGMT(M_EXPORT_LOCKS));
 
         // Export the Lo and Hi lock header comments.
         for (uint8_t hi = 0; hi < 2; hi++)
         {
             for (uint8_t index = 0; index < OUTPUT_LOCK_MAX; index++)
             {
-                Serial.print(PGMT(M_EXPORT_LOCK));
-                Serial.print(PGMT(hi ? M_HI : M_LO));
-                Serial.print(OPTION_ID(index));
+                stream.print(PGMT(M_EXPORT_LOCK));
+                stream.print(PGMT(hi ? M_HI : M_LO));
+                stream.print(OPTION_ID(index));
             }
         }
-        Serial.println();
+        stream.println();
 
         // Export all the locks.
         for (int node = 0; node < OUTPUT_NODE_MAX; node++)
         {
             if (outputCtl.isOutputNodePresent(node))
             {
+                bool locked = (aLocked & ((OutputNodes)1 << node)) != 0;
+
+                if (locked)
+                {
+                    outputCtl.readOutputNode(node);
+                }
+
                 for (int pin = 0; pin < OUTPUT_PIN_MAX; pin++)
                 {
                     // Export a lock definition.
-                    outputCtl.readOutput(node, pin);
+                    if (locked)
+                    {
+                        outputCtl.loadOutput(node, pin);
+                    }
+                    else
+                    {
+                        outputDef.clearLocks();
+                    }
 
-                    Serial.print(PGMT(M_LOCK));
-                    Serial.print(CHAR_TAB);
-                    Serial.print(HEX_CHARS[node]);
-                    Serial.print(CHAR_TAB);
-                    Serial.print(HEX_CHARS[pin]);
+                    stream.print(PGMT(M_LOCK));
+                    stream.print(CHAR_TAB);
+                    stream.print(HEX_CHARS[node]);
+                    stream.print(CHAR_TAB);
+                    stream.print(HEX_CHARS[pin]);
 
                     // Export locks, Lo and Hi
                     for (uint8_t hi = 0; hi < 2; hi++)
@@ -668,24 +1094,24 @@ class ImportExport
                         for (uint8_t index = 0; index < OUTPUT_LOCK_MAX; index++)
                         {
                             // Export a lock.
-                            Serial.print(CHAR_TAB);
+                            stream.print(CHAR_TAB);
                             if (outputDef.isLock(hi, index))
                             {
-                                Serial.print(PGMT(outputDef.getLockState(hi, index) ? M_HI : M_LO));
-                                Serial.print(CHAR_SPACE);
-                                Serial.print(HEX_CHARS[outputDef.getLockNode(hi, index)]);
-                                Serial.print(CHAR_SPACE);
-                                Serial.print(HEX_CHARS[outputDef.getLockPin (hi, index)]);
+                                stream.print(PGMT(outputDef.getLockState(hi, index) ? M_HI : M_LO));
+                                stream.print(CHAR_SPACE);
+                                stream.print(HEX_CHARS[outputDef.getLockNode(hi, index)]);
+                                stream.print(CHAR_SPACE);
+                                stream.print(HEX_CHARS[outputDef.getLockPin (hi, index)]);
                             }
                             else
                             {
-                                Serial.print(CHAR_DOT);
+                                stream.print(CHAR_DOT);
                             }
                         }
                     }
-                    Serial.println();
+                    stream.println();
                 }
-                Serial.println();
+                stream.println();
             }
         }
     }
@@ -694,7 +1120,11 @@ class ImportExport
 
 /** A singleton instance of the class.
  */
-ImportExport importExport;
+#if SERIAL_FRAMED
+ImportExport importExport(configChannel);
+#else
+ImportExport importExport(Serial);
+#endif
 
 
 #endif
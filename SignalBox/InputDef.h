@@ -14,17 +14,30 @@
 #define InputDef_h
 
 
-// Input nodes. If large EEPROM, have 16 input nodes, else only 8.
-#if E2END > 0x800
+// Input nodes. If large EEPROM, have 16 input nodes (24 with wide node numbers), else only 8.
+#if E2END > 0x800 && NODES_WIDE
+const uint8_t INPUT_NODE_MAX    =                   24;     // Maximum nodes.
+const uint8_t INPUT_NODE_MASK   =                 0x1f;     // Mask for node numbers (not all of them are nodes).
+#elif E2END > 0x800
 const uint8_t INPUT_NODE_MAX    =                   16;     // Maximum nodes.
+const uint8_t INPUT_NODE_MASK   = (INPUT_NODE_MAX - 1);     // Mask for node numbers.
 #else
 const uint8_t INPUT_NODE_MAX    =                    8;     // Maximum nodes.
-#endif
 const uint8_t INPUT_NODE_MASK   = (INPUT_NODE_MAX - 1);     // Mask for node numbers.
+#endif
 const uint8_t INPUT_NODE_SHIFT  =                    4;     // Shift input number this amount to get a node number (16 inputs per node so shift 4 bits). 
 const uint8_t INPUT_PIN_MAX     =                   16;     // 16 inputs to each node.
 const uint8_t INPUT_PIN_MASK    = (INPUT_PIN_MAX  - 1);     // Mask to get input pin within a node.
 
+#if NODES_WIDE
+typedef uint32_t InputNodes;                                // Bit map of Input nodes, one bit per node.
+#else
+typedef uint16_t InputNodes;                                // Bit map of Input nodes, one bit per node.
+#endif
+
+static_assert(   (!NODES_WIDE)
+              || (E2END > 0x800), "Wide node numbers need a large EEPROM (a Mega)");
+
 // Mask for Input options
 const uint8_t INPUT_OUTPUT_MAX  =    6;     // Number of outputs each input can control. See also EEPROM in System.h
 // const uint8_t INPUT_OUTPUT_DISP =    3;     // Number of outputs each input can display.
@@ -83,6 +96,9 @@ class InputDef
 
     uint8_t delayMask = 0;              // Mask showing which outputs are "delay"s.
     uint8_t output[INPUT_OUTPUT_MAX];   // The outputs conrolled by this input.
+#if NODES_WIDE
+    uint8_t outputHi  = 0;              // Top bit of each output's node, one bit per output.
+#endif
 
 
     public:
@@ -91,7 +107,7 @@ class InputDef
      */
     uint8_t getOutputNode(uint8_t aIndex)
     {
-        return (output[aIndex] >> OUTPUT_NODE_SHIFT) & OUTPUT_NODE_MASK;
+        return (getOutput(aIndex) >> OUTPUT_NODE_SHIFT) & OUTPUT_NODE_MASK;
     }
 
 
@@ -99,8 +115,8 @@ class InputDef
      */
     void setOutputNode(uint8_t aIndex, uint8_t aOutputNode)
     {
-        output[aIndex] = (output[aIndex] & ~(OUTPUT_NODE_MASK << OUTPUT_NODE_SHIFT))
-                       | ((aOutputNode   &  OUTPUT_NODE_MASK) << OUTPUT_NODE_SHIFT);
+        setOutput(aIndex, (getOutput(aIndex) & OUTPUT_PIN_MASK)
+                        | ((aOutputNode & OUTPUT_NODE_MASK) << OUTPUT_NODE_SHIFT));
     }
 
 
@@ -123,17 +139,33 @@ class InputDef
 
     /** Gets the nth outputNumber.
      */
-    uint8_t getOutput(uint8_t aIndex)
+    uint16_t getOutput(uint8_t aIndex)
     {
+#if NODES_WIDE
+        if (outputHi & (1 << aIndex))
+        {
+            return 0x100 | output[aIndex];
+        }
+#endif
         return output[aIndex];
     }
 
 
     /** Sets the nth outputNumber.
      */
-    void setOutput(uint8_t aIndex, uint8_t aOutputNumber)
+    void setOutput(uint8_t aIndex, uint16_t aOutputNumber)
     {
-        output[aIndex] = aOutputNumber;
+        output[aIndex] = lowByte(aOutputNumber);
+#if NODES_WIDE
+        if (highByte(aOutputNumber) & 1)
+        {
+            outputHi |=  (1 << aIndex);
+        }
+        else
+        {
+            outputHi &= ~(1 << aIndex);
+        }
+#endif
     }
 
 
@@ -23,8 +23,8 @@ const int  INPUT_MAX        = (INPUT_NODE_MAX * INPUT_PIN_MAX);     // Maximum i
 /** Variables for working with an Input.
  *  Global for convenience.
  */
-uint16_t   inputNodes       = 0;    // Bit map of Input nodes present.
-uint8_t    inputNumber      = 0;    // Current Input number.
+InputNodes inputNodes       = 0;    // Bit map of Input nodes present.
+uint16_t   inputNumber      = 0;    // Current Input number.
 InputDef   inputDef;                // Definition of the current Input.
 uint32_t   inputTypes       = 0L;   // The types of the Inputs. 2 bits per pin, 16 pins per node = 32 bits.
 uint8_t    inputType        = 0;    // Type of the current Input (2 bits, INPUT_TYPE_MASK).
@@ -36,11 +36,11 @@ void setInputNodePresent(uint8_t aNode, bool aState)
 {
     if (aState)
     {
-        inputNodes |= (1 << aNode);
+        inputNodes |= ((InputNodes)1 << aNode);
     }
     else
     {
-        inputNodes &= ~(1 << aNode);
+        inputNodes &= ~((InputNodes)1 << aNode);
     }
 }
 
@@ -50,7 +50,7 @@ void setInputNodePresent(uint8_t aNode, bool aState)
 bool isInputNodePresent(uint8_t aNode)
 {
     // Look for input's node in inputNodes flags.
-    return (aNode < INPUT_NODE_MAX) && (inputNodes & (1 << aNode));
+    return (aNode < INPUT_NODE_MAX) && (inputNodes & ((InputNodes)1 << aNode));
 }
 
 
@@ -79,7 +79,7 @@ class InputMgr: public Persisted
 
     /** Load an Input's data from EEPROM.
      */
-    void loadInput(uint8_t aInput)
+    void loadInput(uint16_t aInput)
     {
         loadInput((aInput >> INPUT_NODE_SHIFT) & INPUT_NODE_MASK, aInput & INPUT_PIN_MASK);
     }
@@ -140,7 +140,7 @@ class InputMgr: public Persisted
      */
     void saveInput()
     {
-        // if (inputNumber < INPUT_MAX)         // Can't test inputNumber (a uint8_t) against INPUT_MAX which might be 0x100.
+        // if (inputNumber < INPUT_MAX)
         {
             uint8_t  node = (inputNumber >> INPUT_NODE_SHIFT) & INPUT_NODE_MASK;
             uint8_t  pin  = (inputNumber                    ) & INPUT_PIN_MASK;
@@ -115,6 +115,7 @@ const char* const M_OUTPUT_TYPES[]   = { M_NONE,  M_SERVO,  M_SIGNAL, M_LED, M_L
     const char M_EXPORT[]           PROGMEM = "Export";
     const char M_IMPORT[]           PROGMEM = "Import";
     const char M_ALL[]              PROGMEM = "All";
+    const char M_BACKUP[]           PROGMEM = "Backup";
 
 
     // Configuration - System.
@@ -153,7 +154,7 @@ const char* const M_OUTPUT_TYPES[]   = { M_NONE,  M_SERVO,  M_SIGNAL, M_LED, M_L
     const char* const M_BUTTONS[]        = { M_NONE, M_SELECT, M_LEFT, M_DOWN, M_UP, M_RIGHT };
     const char* const M_TOP_MENU[]       = { M_SYSTEM, M_INPUT, M_OUTPUT, M_LOCK, M_EXPORT, M_IMPORT };
     const char* const M_SYS_TYPES[]      = { M_REPORT, M_NODES, M_IDENT, M_DEBUG };
-    const char* const M_EXPORT_TYPES[]   = { M_ALL, M_SYSTEM, M_INPUT, M_OUTPUT, M_LOCK };
+    const char* const M_EXPORT_TYPES[]   = { M_ALL, M_SYSTEM, M_INPUT, M_OUTPUT, M_LOCK, M_BACKUP };
     const char* const M_REPORT_PROMPTS[] = { M_NONE, M_SHORT, M_LONG, M_PAUSE };
     const char* const M_DEBUG_PROMPTS[]  = { M_NONE, M_ERRORS, M_BRIEF, M_DETAIL, M_FULL };
     const char* const M_INPUT_TYPES[]    = { M_TOGGLE, M_ON_OFF, M_ON,  M_OFF };
@@ -161,6 +162,7 @@ const char* const M_OUTPUT_TYPES[]   = { M_NONE,  M_SERVO,  M_SIGNAL, M_LED, M_L
 
 // Common debug messages.
 
+const char M_DEBUG_ASSIGN[]     PROGMEM = "Assign";
 const char M_DEBUG_ATTACH[]     PROGMEM = "Attach";
 const char M_DEBUG_DEBUG[]      PROGMEM = "Debug";
 const char M_DEBUG_DETACH[]     PROGMEM = "Detach";
@@ -169,6 +171,7 @@ const char M_DEBUG_INP_HI[]     PROGMEM = "InpHi";
 const char M_DEBUG_LOAD[]       PROGMEM = "Load";
 const char M_DEBUG_MOVE[]       PROGMEM = "Move";
 const char M_DEBUG_READ[]       PROGMEM = "Read";
+const char M_DEBUG_READ_ALL[]   PROGMEM = "ReadAll";
 const char M_DEBUG_REPORT[]     PROGMEM = "Report";
 const char M_DEBUG_RESET[]      PROGMEM = "Reset";
 const char M_DEBUG_SAVE[]       PROGMEM = "Save";
@@ -179,9 +182,11 @@ const char M_DEBUG_SET_HI[]     PROGMEM = "SetHi";
 const char M_DEBUG_STATES[]     PROGMEM = "States";
 const char M_DEBUG_SYSTEM[]     PROGMEM = "System";
 const char M_DEBUG_WRITE[]      PROGMEM = "Write";
+const char M_DEBUG_WRITE_FIELDS[] PROGMEM = "WriteFields";
 
 const char M_DEBUG_COMMAND[]    PROGMEM = ", cmd=";
 const char M_DEBUG_DELAY[]      PROGMEM = ", delay=";
+const char M_DEBUG_FIELDS[]     PROGMEM = ", fields=";
 const char M_DEBUG_HI[]         PROGMEM = ", hi=";
 const char M_DEBUG_LEN[]        PROGMEM = ", len=";
 const char M_DEBUG_LO[]         PROGMEM = ", lo=";
@@ -197,15 +202,19 @@ const char M_DEBUG_TYPE[]       PROGMEM = ", type=";
 const char M_DEBUG_VALUE[]      PROGMEM = ", value=";
 
 const char* const M_DEBUG_COMMANDS[]   = { M_DEBUG_SYSTEM, M_DEBUG_DEBUG,  M_DEBUG_SET_LO, M_DEBUG_SET_HI, M_DEBUG_READ, M_DEBUG_WRITE, M_DEBUG_SAVE, M_DEBUG_RESET,
-                                           M_DEBUG_SET,    M_DEBUG_INP_LO, M_DEBUG_INP_HI, M_RFU,          M_RFU,        M_RFU,         M_RFU,        M_NONE };
+                                           M_DEBUG_SET,    M_DEBUG_INP_LO, M_DEBUG_INP_HI, M_DEBUG_READ_ALL, M_DEBUG_WRITE_FIELDS, M_RFU,         M_RFU,        M_NONE };
 
 
     // Controller-only debug messages.
     const char M_DEBUG_BUTTON[]     PROGMEM = "Button";
+    const char M_DEBUG_RECOVER[]    PROGMEM = "Recover I2C";
 
+    const char M_DEBUG_COUNT[]      PROGMEM = ", count=";
+    const char M_DEBUG_MAX[]        PROGMEM = ", max=";
     const char M_DEBUG_OUTPUTS[]    PROGMEM = ", outputs=";
     const char M_DEBUG_PIN[]        PROGMEM = ", pin=";
     const char M_DEBUG_RETURN[]     PROGMEM = ", ret=";
+    const char M_DEBUG_TIME[]       PROGMEM = ", time=";
 
 
     // Output module debug messages.
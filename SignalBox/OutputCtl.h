@@ -17,10 +17,16 @@
 /** Variables for working with an Output.
  *  Global for convenience.
  */
-long       outputNodes  = 0;    // Bit map of Output nodes present (as many as OUTPUT_NODE_MAX - 32 bits).
-uint8_t    outputNode   = 0;    // Current Output node.
-uint8_t    outputPin    = 0;    // Current Output pin.
-OutputDef  outputDef;           // Definition of current Output.
+OutputNodes outputNodes    = 0;    // Bit map of Output nodes present.
+uint8_t     outputNode     = 0;    // Current Output node.
+uint8_t     outputPin      = 0;    // Current Output pin.
+OutputDef   outputDef;             // Definition of current Output.
+uint16_t    stateChanges   = 0;    // Counts changes to the Input and Output states, so their users can spot stale copies.
+OutputNodes outputChanged  = 0;    // Output nodes whose states have changed, cleared by their user (Command's watch).
+InputNodes  inputChanged   = 0;    // Input nodes whose states have changed, cleared by their user (Command's watch).
+OutputNodes gatewayOutputs = 0;    // Output nodes whose states have changed since they were sent to the Gateway.
+InputNodes  gatewayInputs  = 0;    // Input nodes whose states have changed since they were sent to the Gateway.
+uint8_t     outputFields   = 0;    // Fields of the current Output to write, see writeOutputFields().
 
 
 /** Helper to write the current OutputDef.
@@ -29,6 +35,14 @@ void writeOutputDef()
 {
     outputDef.write();
 }
+
+
+/** Helper to write the changed fields of the current OutputDef.
+ */
+void writeOutputFields()
+{
+    outputDef.writeFields(outputFields);
+}
     
 
 class OutputCtl
@@ -36,6 +50,21 @@ class OutputCtl
     private:
     
     uint8_t outputStates[OUTPUT_NODE_MAX];      // State of all the attached output module's Outputs.
+    OutputDef nodeDefs[OUTPUT_PIN_MAX];         // Definitions of all a node's Outputs, see readOutputNode().
+
+    OutputDef sentDef;                          // An Output's definition as last read from, or written to, its OutputModule.
+    uint8_t   sentNode = OUTPUT_NODE_MAX;       // Node of sentDef, OUTPUT_NODE_MAX if there isn't one.
+    uint8_t   sentPin  = 0;                     // Pin of sentDef.
+
+
+    /** Remember the current Output as its OutputModule has it, so later writes need only send changes.
+     */
+    void setSent()
+    {
+        sentNode = outputNode;
+        sentPin  = outputPin;
+        sentDef  = outputDef;
+    }
 
 
     public:
@@ -46,11 +75,11 @@ class OutputCtl
     {
         if (aState)
         {
-            outputNodes |= ((long)1 << aNode);
+            outputNodes |= ((OutputNodes)1 << aNode);
         }
         else
         {
-            outputNodes &= ~((long)1 << aNode);
+            outputNodes &= ~((OutputNodes)1 << aNode);
         }
     }
     
@@ -60,7 +89,7 @@ class OutputCtl
      */
     bool isOutputNodePresent(uint8_t aNode)
     {
-        return (aNode < OUTPUT_NODE_MAX) && (outputNodes & ((long)1 << aNode));
+        return (aNode < OUTPUT_NODE_MAX) && (outputNodes & ((OutputNodes)1 << aNode));
     }
     
     
@@ -68,7 +97,13 @@ class OutputCtl
      */
     void setOutputStates(uint8_t aNode, uint8_t aStates)
     {
-        outputStates[aNode] = aStates;
+        if (outputStates[aNode] != aStates)
+        {
+            outputStates[aNode] = aStates;
+            stateChanges  += 1;
+            outputChanged  |= (OutputNodes)1 << aNode;
+            gatewayOutputs |= (OutputNodes)1 << aNode;
+        }
     }
     
     
@@ -88,11 +123,11 @@ class OutputCtl
     
         if (aState)
         {
-            outputStates[aNode] |= mask;
+            setOutputStates(aNode, outputStates[aNode] | mask);
         }
         else
         {
-            outputStates[aNode] &= ~mask;
+            setOutputStates(aNode, outputStates[aNode] & ~mask);
         }
     }
     
@@ -122,11 +157,12 @@ class OutputCtl
                 Serial.println();
             }
     
-            if (   (i2cComms.sendShort(I2C_OUTPUT_BASE_ID + outputNode, COMMS_CMD_READ | outputPin) == 0)
-                && (i2cComms.requestPacket(I2C_OUTPUT_BASE_ID + outputNode, sizeof(outputDef))))
+            if (   (i2cComms.sendShort(i2cComms.outputId(outputNode), COMMS_CMD_READ | outputPin) == 0)
+                && (i2cComms.requestPacket(i2cComms.outputId(outputNode), OUTPUT_DEF_LEN)))
             {
                 // Read the outputDef from the OutputModule.
                 outputDef.read();
+                setSent();
     
                 if (isDebug(DEBUG_DETAIL))
                 {
@@ -153,26 +189,131 @@ class OutputCtl
     
     /** Read an Output's data from an OutputModule.
      */
-    void readOutput(uint8_t aOutputNumber)
+    void readOutput(uint16_t aOutputNumber)
     {
         readOutput((aOutputNumber >> OUTPUT_NODE_SHIFT) & OUTPUT_NODE_MASK, aOutputNumber & OUTPUT_PIN_MASK);
     }
     
     
+    /** Read all of a node's Output definitions from its OutputModule.
+     *  One READ_ALL command, then a request per page, checking the running checksum as each page arrives.
+     *  Falls back to reading Outputs one at a time if the bulk read fails (e.g. older OutputModule software).
+     *  Use loadOutput() to pick an Output from the node's definitions.
+     */
+    void readOutputNode(uint8_t aNode)
+    {
+        bool    ok       = false;
+        uint8_t checksum = 0;
+
+        if (isOutputNodePresent(aNode))
+        {
+            if (isDebug(DEBUG_DETAIL))
+            {
+                Serial.print(PGMT(M_DEBUG_READ_ALL));
+                Serial.print(HEX_CHARS[aNode]);
+                Serial.println();
+            }
+
+            ok = i2cComms.sendShort(i2cComms.outputId(aNode), COMMS_CMD_READ_ALL) == 0;
+
+            for (uint8_t page = 0, pin = 0; ok && (page < OUTPUT_PAGE_MAX); page++)
+            {
+                if ((ok = i2cComms.requestPacket(i2cComms.outputId(aNode), OUTPUT_PAGE_LEN)))
+                {
+                    for (uint8_t index = 0; index < OUTPUT_PAGE_DEFS; index++, pin++)
+                    {
+                        checksum = nodeDefs[pin].read(checksum);
+                    }
+                    ok = i2cComms.readByte() == checksum;
+                }
+            }
+
+            // Discard any remaining data.
+            i2cComms.readAll();
+        }
+
+        for (uint8_t pin = 0; pin < OUTPUT_PIN_MAX; pin++)
+        {
+            if (!ok)
+            {
+                readOutput(aNode, pin);
+                nodeDefs[pin] = outputDef;
+            }
+            else if (isDebug(DEBUG_DETAIL))
+            {
+                nodeDefs[pin].printDef(M_DEBUG_READ, aNode, pin);
+            }
+        }
+    }
+
+
+    /** Load an Output from the definitions of the node last read by readOutputNode().
+     */
+    void loadOutput(uint8_t aNode, uint8_t aPin)
+    {
+        outputNode = aNode;
+        outputPin  = aPin;
+        outputDef  = nodeDefs[aPin];
+    }
+
+
+    /** Forget what's been sent to the OutputModules, so the next write sends a whole definition.
+     *  Needed when an OutputModule's definitions are changed by other means (e.g. moving locks).
+     */
+    void forgetSent()
+    {
+        sentNode = OUTPUT_NODE_MAX;
+    }
+
+
     /** Write current Output's data to its OutputModule.
+     *  If the Output was the last one read or written, send only the fields that have changed.
+     *  The type is always sent as it carries the state, which the OutputModule may have changed itself.
      */
     void writeOutput()
     {
-        if (isDebug(DEBUG_DETAIL))
+        bool sent = false;
+
+        if (   (sentNode == outputNode)
+            && (sentPin  == outputPin))
         {
-            Serial.print(PGMT(M_DEBUG_WRITE));
-            Serial.print(HEX_CHARS[outputNode]);
-            Serial.print(HEX_CHARS[outputPin]);
-            Serial.println();
-            outputDef.printDef(M_DEBUG_WRITE, outputNode, outputPin);
+            outputFields = outputDef.diff(sentDef) | OUTPUT_FIELD_TYPE;
+
+            if (isDebug(DEBUG_DETAIL))
+            {
+                Serial.print(PGMT(M_DEBUG_WRITE_FIELDS));
+                Serial.print(HEX_CHARS[outputNode]);
+                Serial.print(HEX_CHARS[outputPin]);
+                Serial.print(PGMT(M_DEBUG_FIELDS));
+                Serial.print(outputFields, HEX);
+                Serial.println();
+                outputDef.printDef(M_DEBUG_WRITE_FIELDS, outputNode, outputPin);
+            }
+
+            sent = i2cComms.sendPayload(i2cComms.outputId(outputNode), COMMS_CMD_WRITE_FIELDS | outputPin, writeOutputFields) == 0;
+        }
+        else
+        {
+            if (isDebug(DEBUG_DETAIL))
+            {
+                Serial.print(PGMT(M_DEBUG_WRITE));
+                Serial.print(HEX_CHARS[outputNode]);
+                Serial.print(HEX_CHARS[outputPin]);
+                Serial.println();
+                outputDef.printDef(M_DEBUG_WRITE, outputNode, outputPin);
+            }
+
+            sent = i2cComms.sendPayload(i2cComms.outputId(outputNode), COMMS_CMD_WRITE | outputPin, writeOutputDef) == 0;
+        }
+
+        if (sent)
+        {
+            setSent();
+        }
+        else
+        {
+            forgetSent();
         }
-    
-        i2cComms.sendPayload(I2C_OUTPUT_BASE_ID + outputNode, COMMS_CMD_WRITE | outputPin, writeOutputDef);
     }
     
     
@@ -189,7 +330,7 @@ class OutputCtl
             outputDef.printDef(M_DEBUG_SAVE, outputNode, outputPin);
         }
     
-        i2cComms.sendShort(I2C_OUTPUT_BASE_ID + outputNode, COMMS_CMD_SAVE | outputPin);
+        i2cComms.sendShort(i2cComms.outputId(outputNode), COMMS_CMD_SAVE | outputPin);
     }
     
     
@@ -211,8 +352,7 @@ class OutputCtl
             Serial.println();
         }
     
-        i2cComms.sendData(I2C_OUTPUT_BASE_ID + aNode, command, aNode, aDelay);
-        i2cComms.sendGateway(command, aNode, aDelay);
+        i2cComms.sendData(i2cComms.outputId(aNode), command, aNode, aDelay);
     }
     
     
@@ -230,7 +370,7 @@ class OutputCtl
             outputDef.printDef(M_DEBUG_RESET, outputNode, outputPin);
         }
     
-        i2cComms.sendShort(I2C_OUTPUT_BASE_ID + outputNode, COMMS_CMD_RESET | outputPin);
+        i2cComms.sendShort(i2cComms.outputId(outputNode), COMMS_CMD_RESET | outputPin);
     
         // Reload the Output now it's been reset.
         readOutput(outputNode, outputPin);
@@ -244,8 +384,8 @@ class OutputCtl
     {
         int states;
     
-        if (   (i2cComms.sendShort(I2C_OUTPUT_BASE_ID + aNode, COMMS_CMD_SYSTEM | COMMS_SYS_OUT_STATES) == 0)
-            && ((states = i2cComms.requestByte(I2C_OUTPUT_BASE_ID + aNode)) >= 0))
+        if (   (i2cComms.sendShort(i2cComms.outputId(aNode), COMMS_CMD_SYSTEM | COMMS_SYS_OUT_STATES) == 0)
+            && ((states = i2cComms.requestByte(i2cComms.outputId(aNode))) >= 0))
         {
             setOutputNodePresent(aNode, true);
             setOutputStates(aNode, states);
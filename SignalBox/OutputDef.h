@@ -17,10 +17,22 @@
 // Output nodes.
 const uint8_t OUTPUT_PIN_MAX       =    8;  // 8 outputs to each node.
 const uint8_t OUTPUT_PIN_MASK      =    7;  // 3 bits for 8 pins withing an output node.
+#if NODES_WIDE
+const uint8_t OUTPUT_NODE_MAX      =   64;  // Maximum nodes.
+const uint8_t OUTPUT_NODE_MASK     = 0x3f;  // 6 bits for 64 nodes.
+#else
 const uint8_t OUTPUT_NODE_MAX      =   32;  // Maximum nodes.
-const uint8_t OUTPUT_NODE_HALF     =   16;  // Half the maximum nodes.
 const uint8_t OUTPUT_NODE_MASK     = 0x1f;  // 5 bits for 32 nodes.
+#endif
+const uint8_t OUTPUT_NODE_ROW      =   16;  // Nodes shown on each row of the LCD's node maps.
 const uint8_t OUTPUT_NODE_SHIFT    =    3;  // Shift output number this amount to get a node number.
+const uint8_t OUTPUT_LOCK_NODE     = 0x1f;  // 5 bits of a lock's node kept with its pin, see OutputDef.lockNodeHi.
+
+#if NODES_WIDE
+typedef uint64_t OutputNodes;               // Bit map of Output nodes, one bit per node.
+#else
+typedef uint32_t OutputNodes;               // Bit map of Output nodes, one bit per node.
+#endif
 
 // Output options maxima.
 const uint8_t OUTPUT_SERVO_MAX     =  180;  // Maximum value an angle output parameter can take.
@@ -38,6 +50,28 @@ const uint8_t OUTPUT_LOCK_MAX      =    4;  // Four locks of each type (Hi/Lo).
 
 // Wire response message lengths.
 const uint8_t OUTPUT_MOVE_LOCK_LEN =    2;  // Two bytes used to move a node's locks.
+#if NODES_WIDE
+const uint8_t OUTPUT_DEF_LEN       =   16;  // Sixteen bytes of an OutputDef, see OutputDef.wire().
+#else
+const uint8_t OUTPUT_DEF_LEN       =   15;  // Fifteen bytes of an OutputDef, see OutputDef.wire().
+#endif
+
+// Fields of an OutputDef for delta writes, one mask bit per field in wire order.
+const uint8_t OUTPUT_FIELD_TYPE       = 0x01;   // Type (and state).
+const uint8_t OUTPUT_FIELD_LO         = 0x02;   // Lo setting.
+const uint8_t OUTPUT_FIELD_HI         = 0x04;   // Hi setting.
+const uint8_t OUTPUT_FIELD_PACE       = 0x08;   // Pace.
+const uint8_t OUTPUT_FIELD_RESET      = 0x10;   // Reset interval.
+const uint8_t OUTPUT_FIELD_LOCKS      = 0x20;   // Mask of active locks.
+const uint8_t OUTPUT_FIELD_LOCK_DEFS  = 0x40;   // All eight lock definitions.
+const uint8_t OUTPUT_FIELD_LOCK_STATE = 0x80;   // States of the locks.
+const uint8_t OUTPUT_FIELD_MAX        =    8;   // Number of fields.
+constexpr uint8_t OUTPUT_FIELD_OFFSETS[] = { 0, 1, 2, 3, 4, 5, 6, OUTPUT_DEF_LEN - 1, OUTPUT_DEF_LEN };   // Wire offset of each field, then the end.
+
+// Bulk read of a node's OutputDefs, a Wire-buffer sized page at a time.
+const uint8_t OUTPUT_PAGE_DEFS     = NODES_WIDE ? 1 : 2;                        // OutputDefs in each page.
+const uint8_t OUTPUT_PAGE_MAX      = OUTPUT_PIN_MAX / OUTPUT_PAGE_DEFS;         // Pages needed for the whole node.
+const uint8_t OUTPUT_PAGE_LEN      = OUTPUT_PAGE_DEFS * OUTPUT_DEF_LEN + 1;     // The page's OutputDefs and a running checksum.
 
 // Defaults when initialising.
 const uint8_t OUTPUT_DEFAULT_LO    =   90;  // Default low  position is 90 degrees.
@@ -75,6 +109,9 @@ class OutputDef
     uint8_t locks = 0;                  // The enabled locks.
     uint8_t lockLo[OUTPUT_LOCK_MAX];    // Outputs that lock this output Lo.
     uint8_t lockHi[OUTPUT_LOCK_MAX];    // Outputs that lock this output Hi.
+#if NODES_WIDE
+    uint8_t lockNodeHi = 0;             // Top bit of each lock's node, as the locks.
+#endif
     uint8_t lockState = 0;              // Lock is against output being Hi (else Lo).
 
 
@@ -174,6 +211,14 @@ class OutputDef
     }
 
 
+    /** Are any locks defined?
+     */
+    bool isLocked()
+    {
+        return locks != 0;
+    }
+
+
     /** Is the given lock defined?
      */
     bool isLock(bool aHi, uint8_t aIndex)
@@ -188,7 +233,15 @@ class OutputDef
     {
         uint8_t node = aHi ? lockHi[aIndex] : lockLo[aIndex];
 
-        return (node >> OUTPUT_NODE_SHIFT) & OUTPUT_NODE_MASK;
+        node = (node >> OUTPUT_NODE_SHIFT) & OUTPUT_LOCK_NODE;
+#if NODES_WIDE
+        if (lockNodeHi & (1 << (aIndex + (aHi ? OUTPUT_LOCK_MAX : 0))))
+        {
+            node |= OUTPUT_LOCK_NODE + 1;
+        }
+#endif
+
+        return node;
     }
 
 
@@ -198,12 +251,22 @@ class OutputDef
     {
         if (aHi)
         {
-            lockHi[aIndex] = (lockHi[aIndex] & ~(OUTPUT_NODE_MASK << OUTPUT_NODE_SHIFT)) | ((aNode & OUTPUT_NODE_MASK) << OUTPUT_NODE_SHIFT);
+            lockHi[aIndex] = (lockHi[aIndex] & ~(OUTPUT_LOCK_NODE << OUTPUT_NODE_SHIFT)) | ((aNode & OUTPUT_LOCK_NODE) << OUTPUT_NODE_SHIFT);
         }
         else
         {
-            lockLo[aIndex] = (lockLo[aIndex] & ~(OUTPUT_NODE_MASK << OUTPUT_NODE_SHIFT)) | ((aNode & OUTPUT_NODE_MASK) << OUTPUT_NODE_SHIFT);
+            lockLo[aIndex] = (lockLo[aIndex] & ~(OUTPUT_LOCK_NODE << OUTPUT_NODE_SHIFT)) | ((aNode & OUTPUT_LOCK_NODE) << OUTPUT_NODE_SHIFT);
         }
+#if NODES_WIDE
+        if (aNode & (OUTPUT_LOCK_NODE + 1))
+        {
+            lockNodeHi |=  (1 << (aIndex + (aHi ? OUTPUT_LOCK_MAX : 0)));
+        }
+        else
+        {
+            lockNodeHi &= ~(1 << (aIndex + (aHi ? OUTPUT_LOCK_MAX : 0)));
+        }
+#endif
     }
 
 
@@ -277,44 +340,185 @@ class OutputDef
 
 
     /** Write an Output down the I2C bus.
-     *  Must be the same order as read().
+     *  Encoded into a buffer and sent with a single call.
+     *  Return the running checksum with this Output's bytes added.
      */
-    void write()
+    uint8_t write(uint8_t aChecksum = 0)
     {
-        i2cComms.sendByte(type);
-        i2cComms.sendByte(lo);
-        i2cComms.sendByte(hi);
-        i2cComms.sendByte(pace);
-        i2cComms.sendByte(reset);
+        uint8_t buffer[OUTPUT_DEF_LEN];
 
-        i2cComms.sendByte(locks);
-        for (uint8_t index = 0; index < OUTPUT_LOCK_MAX; index++)
+        wire(buffer, true);
+        i2cComms.sendBuffer(buffer, OUTPUT_DEF_LEN);
+
+        return i2cComms.checksum(aChecksum, buffer, OUTPUT_DEF_LEN);
+    }
+
+
+    /** Read an Output from the I2C bus.
+     *  Read into a buffer and decoded in one pass.
+     *  Return the running checksum with this Output's bytes added.
+     */
+    uint8_t read(uint8_t aChecksum = 0)
+    {
+        uint8_t buffer[OUTPUT_DEF_LEN];
+
+        i2cComms.readBuffer(buffer, OUTPUT_DEF_LEN);
+        wire(buffer, false);
+
+        return i2cComms.checksum(aChecksum, buffer, OUTPUT_DEF_LEN);
+    }
+
+
+    /** Compare with another Output.
+     *  Return a mask (OUTPUT_FIELD_...) of the fields whose wire bytes differ.
+     */
+    uint8_t diff(OutputDef& aOther)
+    {
+        uint8_t mine[OUTPUT_DEF_LEN];
+        uint8_t theirs[OUTPUT_DEF_LEN];
+        uint8_t mask = 0;
+
+        wire(mine, true);
+        aOther.wire(theirs, true);
+
+        for (uint8_t field = 0, bit = 1; field < OUTPUT_FIELD_MAX; field++, bit <<= 1)
         {
-            i2cComms.sendByte(lockLo[index]);
-            i2cComms.sendByte(lockHi[index]);
+            if (memcmp(mine + OUTPUT_FIELD_OFFSETS[field], theirs + OUTPUT_FIELD_OFFSETS[field],
+                       OUTPUT_FIELD_OFFSETS[field + 1] - OUTPUT_FIELD_OFFSETS[field]) != 0)
+            {
+                mask |= bit;
+            }
         }
-        i2cComms.sendByte(lockState);
+
+        return mask;
     }
 
 
-    /** Read an Output from the I2C bus.
-     *  Must be the same order as write().
+    /** Length on the wire of the fields in a mask.
      */
-    void read()
+    static uint8_t fieldsLen(uint8_t aMask)
     {
-        type  = i2cComms.readByte();
-        lo    = i2cComms.readByte();
-        hi    = i2cComms.readByte();
-        pace  = i2cComms.readByte();
-        reset = i2cComms.readByte();
+        uint8_t len = 0;
 
-        locks = i2cComms.readByte();
-        for (uint8_t index = 0; index < OUTPUT_LOCK_MAX; index++)
+        for (uint8_t field = 0, bit = 1; field < OUTPUT_FIELD_MAX; field++, bit <<= 1)
+        {
+            if (aMask & bit)
+            {
+                len += OUTPUT_FIELD_OFFSETS[field + 1] - OUTPUT_FIELD_OFFSETS[field];
+            }
+        }
+
+        return len;
+    }
+
+
+    /** Write the masked fields of an Output down the I2C bus.
+     *  The mask first, then the fields in wire order, sent with a single call.
+     */
+    void writeFields(uint8_t aMask)
+    {
+        uint8_t buffer[OUTPUT_DEF_LEN];
+        uint8_t fields[OUTPUT_DEF_LEN + 1];
+        uint8_t len = 0;
+
+        wire(buffer, true);
+
+        fields[len++] = aMask;
+        for (uint8_t field = 0, bit = 1; field < OUTPUT_FIELD_MAX; field++, bit <<= 1)
+        {
+            for (uint8_t index = OUTPUT_FIELD_OFFSETS[field]; (aMask & bit) && (index < OUTPUT_FIELD_OFFSETS[field + 1]); index++)
+            {
+                fields[len++] = buffer[index];
+            }
+        }
+
+        i2cComms.sendBuffer(fields, len);
+    }
+
+
+    /** Read the masked fields of an Output from the I2C bus.
+     *  The fields not in the mask are left alone.
+     */
+    void readFields(uint8_t aMask)
+    {
+        uint8_t buffer[OUTPUT_DEF_LEN];
+
+        wire(buffer, true);
+
+        for (uint8_t field = 0, bit = 1; field < OUTPUT_FIELD_MAX; field++, bit <<= 1)
+        {
+            if (aMask & bit)
+            {
+                i2cComms.readBuffer(buffer + OUTPUT_FIELD_OFFSETS[field], OUTPUT_FIELD_OFFSETS[field + 1] - OUTPUT_FIELD_OFFSETS[field]);
+            }
+        }
+
+        wire(buffer, false);
+    }
+
+
+    /** Add this Output's wire bytes to a running checksum without sending them.
+     */
+    uint8_t checksum(uint8_t aChecksum)
+    {
+        uint8_t buffer[OUTPUT_DEF_LEN];
+
+        wire(buffer, true);
+
+        return i2cComms.checksum(aChecksum, buffer, OUTPUT_DEF_LEN);
+    }
+
+
+    /** Encode the Output into (or decode it from) a wire buffer.
+     *  The wire layout is described once, here, as the offset of each byte on the wire.
+     *  Locks travel as Lo/Hi pairs, followed (for wide node numbers) by the top bits of their nodes.
+     */
+    void wire(uint8_t* aBuffer, bool aEncode)
+    {
+        typedef WireLayout<offsetof(OutputDef, type),      offsetof(OutputDef, lo),        offsetof(OutputDef, hi),
+                           offsetof(OutputDef, pace),      offsetof(OutputDef, reset),     offsetof(OutputDef, locks),
+                           offsetof(OutputDef, lockLo[0]), offsetof(OutputDef, lockHi[0]),
+                           offsetof(OutputDef, lockLo[1]), offsetof(OutputDef, lockHi[1]),
+                           offsetof(OutputDef, lockLo[2]), offsetof(OutputDef, lockHi[2]),
+                           offsetof(OutputDef, lockLo[3]), offsetof(OutputDef, lockHi[3]),
+#if NODES_WIDE
+                           offsetof(OutputDef, lockNodeHi),
+#endif
+                           offsetof(OutputDef, lockState)> Layout;
+
+        static_assert(OUTPUT_LOCK_MAX   == 4,              "OutputDef wire layout expects four locks of each type");
+        static_assert(Layout::SIZE      == OUTPUT_DEF_LEN, "OutputDef wire layout isn't OUTPUT_DEF_LEN bytes");
+        static_assert(sizeof(OutputDef) == OUTPUT_DEF_LEN, "OutputDef has drifted from its wire layout");
+        static_assert(OUTPUT_PAGE_LEN   <= BUFFER_LENGTH,  "OutputDef page doesn't fit the Wire buffer");
+
+        // Each field where OUTPUT_FIELD_OFFSETS (and the other end of the wire) expects it.
+        static_assert(   (Layout::wireOffset(offsetof(OutputDef, type))      == OUTPUT_FIELD_OFFSETS[0])
+                      && (Layout::wireOffset(offsetof(OutputDef, lo))        == OUTPUT_FIELD_OFFSETS[1])
+                      && (Layout::wireOffset(offsetof(OutputDef, hi))        == OUTPUT_FIELD_OFFSETS[2])
+                      && (Layout::wireOffset(offsetof(OutputDef, pace))      == OUTPUT_FIELD_OFFSETS[3])
+                      && (Layout::wireOffset(offsetof(OutputDef, reset))     == OUTPUT_FIELD_OFFSETS[4])
+                      && (Layout::wireOffset(offsetof(OutputDef, locks))     == OUTPUT_FIELD_OFFSETS[5]),   "OutputDef field has moved on the wire");
+        static_assert(   (Layout::wireOffset(offsetof(OutputDef, lockLo[0])) == OUTPUT_FIELD_OFFSETS[6])
+                      && (Layout::wireOffset(offsetof(OutputDef, lockHi[0])) == OUTPUT_FIELD_OFFSETS[6] + 1)
+                      && (Layout::wireOffset(offsetof(OutputDef, lockLo[1])) == OUTPUT_FIELD_OFFSETS[6] + 2)
+                      && (Layout::wireOffset(offsetof(OutputDef, lockHi[1])) == OUTPUT_FIELD_OFFSETS[6] + 3)
+                      && (Layout::wireOffset(offsetof(OutputDef, lockLo[2])) == OUTPUT_FIELD_OFFSETS[6] + 4)
+                      && (Layout::wireOffset(offsetof(OutputDef, lockHi[2])) == OUTPUT_FIELD_OFFSETS[6] + 5)
+                      && (Layout::wireOffset(offsetof(OutputDef, lockLo[3])) == OUTPUT_FIELD_OFFSETS[6] + 6)
+                      && (Layout::wireOffset(offsetof(OutputDef, lockHi[3])) == OUTPUT_FIELD_OFFSETS[6] + 7),   "OutputDef lock has moved on the wire");
+#if NODES_WIDE
+        static_assert(   (Layout::wireOffset(offsetof(OutputDef, lockNodeHi)) == OUTPUT_FIELD_OFFSETS[6] + 8),  "OutputDef lock nodes have moved on the wire");
+#endif
+        static_assert(   (Layout::wireOffset(offsetof(OutputDef, lockState)) == OUTPUT_FIELD_OFFSETS[7]),       "OutputDef lock state has moved on the wire");
+
+        if (aEncode)
+        {
+            Layout::encode((const uint8_t*)this, aBuffer);
+        }
+        else
         {
-            lockLo[index] = i2cComms.readByte();
-            lockHi[index] = i2cComms.readByte();
+            Layout::decode((uint8_t*)this, aBuffer);
         }
-        lockState = i2cComms.readByte();
     }
 
 
@@ -0,0 +1,358 @@
+/** Framed serial multiplexer.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *  With SERIAL_FRAMED, the debug log, CMRI, commands and import/export share Serial as separate logical channels.
+ *  Each is a MuxChannel (a Stream) whose traffic is carried in frames:
+ *
+ *      Sync        MUX_SYNC.
+ *      Channel     MUX_CHANNEL_CMRI etc.
+ *      Length      Payload length, 1 to MUX_FRAME_MAX.
+ *      Payload     The channel's bytes.
+ *      Checksum    Running checksum (see commsChecksum()) of Channel, Length and Payload.
+ *
+ *  The debug log is written to Serial throughout the sketch, so once this file is included (straight after Config.h),
+ *  Serial is defined to be the log's channel. Only this file writes to the real Serial.
+ *  bin/sbMux splits the channels out again on the host.
+ *
+ *  Each channel buffers its largest message (an escaped CMRI TRANSMIT, a backup record and its CRC, etc).
+ *  When a frame arrives for a channel without room, it's held, and Serial isn't read until the channel has room.
+ *  Frames for a channel nobody is listening to (e.g. import/export when not importing) are dropped
+ *  (and counted as errors), so they can't hold up the others.
+ */
+
+#ifndef SerialMux_h
+#define SerialMux_h
+
+
+#include "Transport.h"
+
+
+const uint8_t MUX_SYNC           = 0xA5;        // Start of frame.
+const uint8_t MUX_FRAME_MAX      = 32;          // Maximum payload of a frame.
+const uint8_t MUX_BUFFER_LEN     = 32;          // Received bytes buffered for commands and import/export.
+#if E2END > 0x800 && NODES_WIDE
+const uint8_t MUX_CMRI_LEN       = 230;         // Received bytes buffered for CMRI, an escaped TRANSMIT (CMRI_REPLY_MAX, see Cmri.h).
+#elif E2END > 0x800
+const uint8_t MUX_CMRI_LEN       = 134;         // Received bytes buffered for CMRI, an escaped TRANSMIT (CMRI_REPLY_MAX, see Cmri.h).
+#else
+const uint8_t MUX_CMRI_LEN       = 102;
+#endif
+
+const uint8_t MUX_CHANNEL_LOG    = 0;           // Debug log, sent only.
+const uint8_t MUX_CHANNEL_CMRI   = 1;           // CMRI.
+const uint8_t MUX_CHANNEL_CMD    = 2;           // Commands (see Command).
+const uint8_t MUX_CHANNEL_CONFIG = 3;           // Import/export (see ImportExport).
+const uint8_t MUX_CHANNEL_MAX    = 4;
+
+
+/** A logical channel on the multiplexed Serial.
+ *  Bytes written are sent in a frame when the frame is full, or when SerialMux next updates.
+ *  The log's lines are sent as they end, so they're not held up if the sketch stops (see systemFail()).
+ */
+class MuxChannel: public Stream
+{
+    private:
+
+    uint8_t  channel;                           // This channel's ID.
+    bool     listening;                         // Someone reads the channel, so its frames must not be dropped.
+    uint8_t* rxBuffer;                          // Bytes received, a ring buffer.
+    uint8_t  rxLength;                          // Length of the buffer.
+    uint8_t  rxHead  = 0;                       // Next byte to read.
+    uint8_t  rxCount = 0;                       // Number of bytes waiting to be read.
+    uint8_t  txBuffer[MUX_FRAME_MAX];           // Bytes waiting to be sent.
+    uint8_t  txCount = 0;                       // Number of bytes waiting to be sent.
+
+
+    public:
+
+    /** A channel with the given ID, receiving into the given buffer.
+     */
+    MuxChannel(uint8_t aChannel, bool aListening, uint8_t* aBuffer, uint8_t aLength):
+        channel(aChannel),
+        listening(aListening),
+        rxBuffer(aBuffer),
+        rxLength(aLength)
+    {
+    }
+
+
+    /** Start the real Serial (for the log channel, which stands in for it).
+     */
+    void begin(unsigned long aSpeed)
+    {
+        Serial.begin(aSpeed);
+    }
+
+
+    /** Start or stop listening to the channel.
+     */
+    void listen(bool aListening)
+    {
+        listening = aListening;
+    }
+
+
+    /** Is someone listening to the channel?
+     */
+    bool isListening()
+    {
+        return listening;
+    }
+
+
+    /** Room for a received frame's payload?
+     */
+    bool hasRoom(uint8_t aLength)
+    {
+        return rxCount + aLength <= rxLength;
+    }
+
+
+    /** Add a received frame's payload.
+     */
+    void receive(uint8_t* aPayload, uint8_t aLength)
+    {
+        while (aLength-- > 0)
+        {
+            rxBuffer[(rxHead + rxCount++) % rxLength] = *aPayload++;
+        }
+    }
+
+
+    /** Are there bytes waiting to be sent?
+     */
+    bool isPending()
+    {
+        return txCount > 0;
+    }
+
+
+    /** Send the waiting bytes as a frame.
+     */
+    void flush()
+    {
+        if (txCount > 0)
+        {
+            uint8_t header[3] = { MUX_SYNC, channel, txCount };
+            uint8_t checksum  = commsChecksum(commsChecksum(0, header + 1, 2), txBuffer, txCount);
+
+            Serial.write(header, sizeof(header));
+            Serial.write(txBuffer, txCount);
+            Serial.write(checksum);
+            txCount = 0;
+        }
+    }
+
+
+    // Stream methods.
+
+    int available()
+    {
+        return rxCount;
+    }
+
+
+    int peek()
+    {
+        return (rxCount > 0) ? rxBuffer[rxHead] : -1;
+    }
+
+
+    int read()
+    {
+        int ch = peek();
+
+        if (rxCount > 0)
+        {
+            rxHead   = (rxHead + 1) % rxLength;
+            rxCount -= 1;
+        }
+
+        return ch;
+    }
+
+
+    size_t write(uint8_t aByte)
+    {
+        txBuffer[txCount++] = aByte;
+
+        if (   (txCount >= MUX_FRAME_MAX)
+            || (   (channel == MUX_CHANNEL_LOG)
+                && (aByte == '\n')))
+        {
+            flush();
+        }
+
+        return 1;
+    }
+
+
+    using Print::write;
+
+
+    /** Room to write without sending a frame.
+     *  A frame is sent as soon as it's full, so report Serial's room, less a frame's overhead.
+     */
+    int availableForWrite()
+    {
+        int room = Serial.availableForWrite() - 4;
+        return (room > 0) ? room : 0;
+    }
+};
+
+
+uint8_t    muxCmriBuffer[MUX_CMRI_LEN];         // The channels' receive buffers.
+uint8_t    muxCommandBuffer[MUX_BUFFER_LEN];
+uint8_t    muxConfigBuffer[MUX_BUFFER_LEN];
+
+MuxChannel logChannel(MUX_CHANNEL_LOG,       false,          NULL,             0);                // The logical channels.
+MuxChannel cmriChannel(MUX_CHANNEL_CMRI,     SERIAL_CMRI,    muxCmriBuffer,    MUX_CMRI_LEN);
+MuxChannel commandChannel(MUX_CHANNEL_CMD,   SERIAL_COMMAND, muxCommandBuffer, MUX_BUFFER_LEN);
+MuxChannel configChannel(MUX_CHANNEL_CONFIG, false,          muxConfigBuffer,  MUX_BUFFER_LEN);   // Listened to while importing.
+
+
+/** Serial multiplexer.
+ *  Splits received frames out to their channels, and sends the channels' frames in turn.
+ */
+class SerialMux
+{
+    private:
+
+    MuxChannel* channels[MUX_CHANNEL_MAX] = { &logChannel, &cmriChannel, &commandChannel, &configChannel };
+
+    uint8_t frame[MUX_FRAME_MAX + 2];           // Frame being received: channel, length and payload.
+    uint8_t frameLen   = 0;                     // Bytes of the frame received so far.
+    bool    framing    = false;                 // Receiving a frame.
+    bool    holding    = false;                 // Holding a whole frame until its channel has room.
+    uint8_t nextSend   = 0;                     // Channel to send first, so channels take turns.
+    uint16_t errors    = 0;                     // Corrupt, unknown or dropped frames.
+
+
+    public:
+
+    /** Update the multiplexer.
+     *  Read everything received, delivering each frame to its channel.
+     *  Stop reading while a frame is held for a full channel, leaving the rest in Serial's buffer.
+     *  Then send a frame from each channel with bytes waiting, starting with a different channel each time.
+     */
+    void update()
+    {
+        if (holding)
+        {
+            deliver();
+        }
+
+        while (   (!holding)
+               && (Serial.available() > 0))
+        {
+            receiveByte(Serial.read());
+        }
+
+        for (uint8_t index = 0; index < MUX_CHANNEL_MAX; index++)
+        {
+            MuxChannel* channel = channels[(nextSend + index) % MUX_CHANNEL_MAX];
+
+            if (   (channel != NULL)
+                && (channel->isPending()))
+            {
+                channel->flush();
+            }
+        }
+
+        nextSend = (nextSend + 1) % MUX_CHANNEL_MAX;
+    }
+
+
+    /** Gets the number of corrupt, unknown or dropped frames received.
+     */
+    uint16_t getErrors()
+    {
+        return errors;
+    }
+
+
+    private:
+
+    /** Process a received byte.
+     */
+    void receiveByte(uint8_t aByte)
+    {
+        if (!framing)
+        {
+            // Ignore anything until a frame starts.
+            framing  = aByte == MUX_SYNC;
+            frameLen = 0;
+        }
+        else if (   (frameLen < 2)
+                 || (frameLen < frame[1] + 2))
+        {
+            frame[frameLen++] = aByte;
+
+            if (   (frameLen == 2)
+                && (   (aByte == 0)
+                    || (aByte > MUX_FRAME_MAX)))
+            {
+                framing  = false;               // Impossible length.
+                errors  += 1;
+            }
+        }
+        else
+        {
+            framing = false;
+
+            if (   (aByte == commsChecksum(0, frame, frameLen))
+                && (frame[0] >  MUX_CHANNEL_LOG)
+                && (frame[0] <  MUX_CHANNEL_MAX)
+                && (channels[frame[0]]->isListening()))
+            {
+                holding = true;
+                deliver();
+            }
+            else
+            {
+                errors += 1;                    // Corrupt, unknown, or nobody listening to its channel.
+            }
+        }
+    }
+
+
+    /** Deliver the held frame to its channel, if it has room (or nobody's listening any more).
+     */
+    void deliver()
+    {
+        MuxChannel* channel = channels[frame[0]];
+
+        if (channel->hasRoom(frame[1]))
+        {
+            channel->receive(frame + 2, frame[1]);
+            holding = false;
+        }
+        else if (!channel->isListening())
+        {
+            errors += 1;                        // Dropped.
+            holding = false;
+        }
+    }
+};
+
+
+/** A singleton instance of the class.
+ */
+SerialMux serialMux;
+
+
+#if SERIAL_FRAMED
+// Everything after here writes the debug log to its channel.
+#define Serial logChannel
+#endif
+
+
+#endif
@@ -54,6 +54,9 @@
 
 
 #include "Config.h"                 // Common classes
+#if SERIAL_FRAMED
+#include "SerialMux.h"              // Before anything writes to Serial.
+#endif
 #include "Messages.h"
 #include "Persisted.h"
 #include "SystemMgr.h"
@@ -177,6 +180,21 @@ void firstRun()
 }
 
 
+/** Process a message received over I2C.
+ *  Only the Gateway sends us messages, ringing the doorbell when it has requests.
+ */
+void processDoorbell(int aLen)
+{
+    if (   (aLen > 0)
+        && (i2cComms.readByte() == (COMMS_CMD_SYSTEM | COMMS_SYS_GATEWAY)))
+    {
+        controller.gatewayDoorbell();
+    }
+
+    i2cComms.readAll();
+}
+
+
 /** Pause for user-input if so configured.
  *  Use buttons to adjust report level.
  */
@@ -233,13 +251,23 @@ void reportPause()
 //}
 
 
+#if SERIAL_FRAMED
+#if SERIAL_COMMAND
+Command command(commandChannel);    // Serial command handler using its own channel.
+#endif
+
+#if SERIAL_CMRI
+Cmri cmri(cmriChannel);             // Cmri handler using its own channel.
+#endif
+#else
 #if SERIAL_COMMAND
-Command command;                    // Serial command handler.
+Command command(Serial);            // Serial command handler.
 #endif
 
 #if SERIAL_CMRI
 Cmri cmri(Serial);                  // Cmri handler using Serial.
 #endif
+#endif
 
 
 /** Setup the Arduino.
@@ -270,6 +298,7 @@ void setup()
 
     // Initialise I2C.
     i2cComms.setId(I2C_CONTROLLER_ID);          // I2C network
+    i2cComms.resetSegments();                   // Start with all multiplexer segments disconnected.
 
 #if LCD_I2C
     // Scan for I2C LCD.
@@ -298,6 +327,15 @@ void setup()
         && (i2cComms.exists(I2C_GATEWAY_ID)))
     {
         i2cComms.setGateway(I2C_GATEWAY_ID);
+
+        if (GATEWAY_ATTENTION_PIN > 0)
+        {
+            pinMode(GATEWAY_ATTENTION_PIN, INPUT_PULLUP);   // Gateway pulls it low when it has requests.
+        }
+        else if (!COMMS_RS485)
+        {
+            i2cComms.onReceive(processDoorbell);            // Gateway rings our doorbell when it has requests.
+        }
     }
 
     // Initialise
@@ -361,6 +399,12 @@ void setup()
 
     // Scan for Input and Output nodes.
     controller.scanHardware();
+
+    // Bring the Gateway's mirror of the states up to date.
+    if (I2C_GATEWAY_ID > 0)
+    {
+        controller.gatewaySnapshot();
+    }
 }
 
 
@@ -375,8 +419,12 @@ void loop()
         controller.announce();
     }
 
+#if SERIAL_FRAMED
+    serialMux.update();     // Exchange frames for the serial channels.
+#endif
+
 #if SERIAL_CMRI
-#if SERIAL_COMMAND
+#if SERIAL_COMMAND && !SERIAL_FRAMED
     if (command.isIdle())   // Don't interfere with command if it's busy.
 #endif
     {
@@ -385,7 +433,7 @@ void loop()
 #endif
 
 #if SERIAL_COMMAND
-#if SERIAL_CMRI
+#if SERIAL_CMRI && !SERIAL_FRAMED
     if (cmri.isIdle())      // Don't interfere with CMRI if it's busy.
 #endif
     {
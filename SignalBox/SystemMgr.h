@@ -14,8 +14,12 @@
 #define System_h
 
 
-#if SB_CONTROLLER
+#if SB_CONTROLLER && NODES_WIDE
+    const long MAGIC_NUMBER = 0x586f6253;   // Magic number = "SboX", wide node numbers (a different EEPROM layout).
+#elif SB_CONTROLLER
     const long MAGIC_NUMBER = 0x786f6253;   // Magic number = "Sbox".
+#elif SB_OUTPUT_MODULE && NODES_WIDE
+    const long MAGIC_NUMBER = 0x54756f53;   // Magic number = "SouT", wide node numbers (a different EEPROM layout).
 #elif SB_OUTPUT_MODULE
     const long MAGIC_NUMBER = 0x74756f53;   // Magic number = "Sout".
 #endif
@@ -49,6 +53,9 @@ const uint8_t REPORT_MAX        = 4;    // Maximum report option.
 // Options identified by a character.
 #define OPTION_ID(index) ((char)(CHAR_UPPER_A + index))
 const uint8_t SYS_MODULE_ID_JUMPERS = 0xff;     // Use jumpers to decide module ID.
+const uint8_t SYS_MODULE_ID_UNASSIGNED = 0xfe;  // Waiting for the controller to assign a module ID, see I2C_ENUM_ID.
+const uint8_t SYS_NOISE_BITS = 2;               // Bits of Timer0's count taken at each watchdog timeout, see newUniqueId().
+const uint8_t SYS_UNIQUE_BITS = 40;             // Bits of unique ID and check byte.
 
 
 // Custom character to indicate "Lo".
@@ -85,9 +92,30 @@ const char    CHAR_LOWER_A = 'a';
 
 const char    CHAR_LO      = 0;
 
-// Hex characters - they are in fact base 32.
+// Hex characters - they are in fact base 32 (base 64 for wide node numbers).
+#if NODES_WIDE
+const char    HEX_CHARS[]  = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz$&";
+#else
 const char    HEX_CHARS[]  = "0123456789ABCDEFGHIJKLMNOPQRSTUV";
+#endif
 const uint8_t HEX_MAX      = sizeof(HEX_CHARS);
+const uint8_t HEX_MASK     = HEX_MAX - 2;  // Mask for a character's value.
+
+
+#if SB_OUTPUT_MODULE
+#include <avr/wdt.h>
+
+
+volatile bool watchdogTimeout = false;          // The watchdog timed out, see SystemMgr.newUniqueId().
+
+
+/** Watchdog interrupt, only enabled while picking a unique ID.
+ */
+ISR(WDT_vect)
+{
+    watchdogTimeout = true;
+}
+#endif
 
 
 /** A System manager (extends Persisted) for persisting SystemData in EEPROM.
@@ -97,6 +125,9 @@ class SystemMgr: public Persisted
     private:
 
     uint8_t jumperModuleId = 0;                                 // The hardware module ID - read from jumperPins.
+    uint8_t jumperMask     = 0;                                 // The jumperPins that can be read.
+    uint32_t uniqueId      = 0;                                 // Random ID to single out this module during enumeration.
+    uint8_t  uniqueCheck   = 0;                                 // Random byte to check the assigned module is alone.
 
     /** Data describing an Output's operation.
      */
@@ -144,6 +175,8 @@ class SystemMgr: public Persisted
         {
             if (jumperPins[pin] <= ANALOG_PIN_LAST)
             {
+                jumperMask |= mask;
+
                 // Pins should be in INPUT_PULLUP state at startup.
                 pinMode(jumperPins[pin], INPUT_PULLUP);
 //                Serial.print("Pin ");
@@ -280,7 +313,7 @@ class SystemMgr: public Persisted
 
 #if SB_OUTPUT_MODULE
         // Decide how many jumper pins to indicate
-        uint8_t maskLimit = 0x20;        // TODO - tie to OUTPUT_NODE_MAX.
+        uint8_t maskLimit = NODES_WIDE ? 0x40 : 0x20;   // One past the top bit of a node number.
         if (isJumperId())
         {
             maskLimit >>= 1;             // Don't show software jumper pin.
@@ -309,6 +342,74 @@ class SystemMgr: public Persisted
     }
 
 
+    /** Are any jumpers fitted?
+     *  A fitted jumper pulls its pin low.
+     */
+    bool hasJumpers()
+    {
+        return jumperModuleId != jumperMask;
+    }
+
+
+    /** Is the OutputModule waiting for the controller to assign its ID?
+     */
+    bool isUnassigned()
+    {
+        return systemData.i2cModuleId == SYS_MODULE_ID_UNASSIGNED;
+    }
+
+
+#if SB_OUTPUT_MODULE
+    /** Pick a new random unique ID, and check byte, for enumeration.
+     *  The watchdog runs from its own RC oscillator, so Timer0's count when it times out jitters,
+     *  differently on each module and each time. Take the count's low bits at each timeout.
+     *  Takes 20 watchdog timeouts (about 320 msecs).
+     */
+    void newUniqueId()
+    {
+        uint8_t sreg = SREG;
+
+        noInterrupts();
+        wdt_reset();
+        WDTCSR = _BV(WDCE) | _BV(WDE);
+        WDTCSR = _BV(WDIE);                     // Interrupt (not reset) every 16 msecs.
+        SREG = sreg;
+
+        for (uint8_t bits = 0; bits < SYS_UNIQUE_BITS; bits += SYS_NOISE_BITS)
+        {
+            watchdogTimeout = false;
+            while (!watchdogTimeout)
+            {
+            }
+
+            uniqueCheck = (uniqueCheck << SYS_NOISE_BITS) | (uniqueId >> (32 - SYS_NOISE_BITS));
+            uniqueId    = (uniqueId    << SYS_NOISE_BITS) | (TCNT0 & ((1 << SYS_NOISE_BITS) - 1));
+        }
+
+        noInterrupts();
+        WDTCSR = _BV(WDCE) | _BV(WDE);
+        WDTCSR = 0;                             // Watchdog off.
+        SREG = sreg;
+    }
+#endif
+
+
+    /** Gets the random ID used to single out this OutputModule during enumeration.
+     */
+    uint32_t getUniqueId()
+    {
+        return uniqueId;
+    }
+
+
+    /** Gets the random byte used to check the assigned OutputModule is alone on its node.
+     */
+    uint8_t getUniqueCheck()
+    {
+        return uniqueCheck;
+    }
+
+
     /** Set the OutputModule I2C Id.
      */
     void setModuleId(uint8_t aModuleId)
@@ -330,11 +431,11 @@ class SystemMgr: public Persisted
         {
             Serial.print(PGMT(M_DEBUG_MODULE));
             Serial.print(CHAR_SPACE);
-            Serial.print(I2C_OUTPUT_BASE_ID + moduleId, HEX);
+            Serial.print(I2C_OUTPUT_BASE_ID + (moduleId & I2C_OUTPUT_ID_MASK), HEX);
             Serial.println();
         }
 
-        return (aIncludeBase ? I2C_OUTPUT_BASE_ID : 0) + moduleId;
+        return aIncludeBase ? I2C_OUTPUT_BASE_ID + (moduleId & I2C_OUTPUT_ID_MASK) : moduleId;
     }
 
 
@@ -485,6 +586,28 @@ int charToHex(char ch)
 }
 
 
+/** Convert a character to a node number.
+ *  Wide node numbers use HEX_CHARS' lower-case letters too, so are case-sensitive.
+ *  Otherwise as charToHex().
+ */
+int charToNode(char ch)
+{
+#if NODES_WIDE
+    for (uint8_t value = 0; value <= HEX_MASK; value++)
+    {
+        if (HEX_CHARS[value] == ch)
+        {
+            return value;
+        }
+    }
+
+    return -HEX_MAX;
+#else
+    return charToHex(ch);
+#endif
+}
+
+
 /** Print a number as a string of hex digits.
  *  Padded with leading zeros to length aDigits.
  */
@@ -0,0 +1,88 @@
+/** Just enough of the Arduino core to build sketch headers on Linux.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Used by the host programs in this directory (see cbusBench.cpp, cmriNode.cpp and muxTest.cpp).
+ *  Each defines the sketch constants its header needs, then includes the sketch's own header.
+ */
+
+#ifndef Host_h
+#define Host_h
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+
+#define lowByte(w)  ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define min(a, b)   ((a) < (b) ? (a) : (b))
+#define max(a, b)   ((a) > (b) ? (a) : (b))
+
+
+/** Microseconds since some fixed point.
+ */
+inline unsigned long micros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)(now.tv_sec * 1000000UL + now.tv_nsec / 1000);
+}
+
+
+/** Milliseconds since some fixed point.
+ */
+inline unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+
+/** Pins. There's no hardware, so every pin reads HIGH (an idle I2C bus).
+ */
+const uint8_t LOW    = 0;
+const uint8_t HIGH   = 1;
+const uint8_t INPUT  = 0;
+const uint8_t OUTPUT = 1;
+const uint8_t SDA    = 18;
+const uint8_t SCL    = 19;
+
+inline void pinMode(uint8_t aPin, uint8_t aMode)    { }
+inline int  digitalRead(uint8_t aPin)               { return HIGH; }
+inline void delayMicroseconds(unsigned int aMicros) { }
+
+
+/** The parts of Arduino's Stream the sketch headers use.
+ */
+class Stream
+{
+    public:
+
+    virtual int    available() = 0;
+    virtual int    peek() = 0;
+    virtual int    read() = 0;
+    virtual size_t write(uint8_t aByte) = 0;
+    virtual size_t write(const uint8_t* aBuffer, size_t aLength)
+    {
+        size_t written = 0;
+        while (   (written < aLength)
+               && (write(aBuffer[written]) == 1))
+        {
+            written += 1;
+        }
+        return written;
+    }
+};
+
+
+#endif
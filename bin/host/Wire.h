@@ -0,0 +1,240 @@
+/** A simulated I2C bus with TCA9548A multiplexers, standing in for Arduino's Wire library.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Found by the sketches' #include <Wire.h> when built with -Ibin/host (see muxTest.cpp).
+ *
+ *  Devices are added on the main bus, or on a segment (channel) of one of the multiplexers at WIRE_MUX_BASE_ID.
+ *  A device answers if it's on the main bus, or on a segment its multiplexer has connected.
+ *  Writing a byte to a multiplexer sets its connected channels, one bit per channel.
+ *  The bus records what each transfer reached, and counts the multiplexer writes and any collisions.
+ */
+
+#ifndef Wire_h
+#define Wire_h
+
+
+#include "Host.h"
+
+
+#define BUFFER_LENGTH 32
+
+
+const uint8_t WIRE_MUX_BASE_ID  = 0x70;     // TCA9548A base ID.
+const uint8_t WIRE_MUX_MAX      =    8;     // Multiplexers the bus can hold.
+const uint8_t WIRE_MUX_SHIFT    =    3;     // Shift segment this amount to get its multiplexer.
+const uint8_t WIRE_MUX_CHANNELS = 0x07;     // Mask for a segment's channel within its multiplexer.
+const uint8_t WIRE_MAIN_BUS     = 0xff;     // "Segment" of devices on the main bus.
+const uint8_t WIRE_DEVICE_MAX   =   64;     // Devices the bus can hold.
+
+const uint8_t WIRE_ACK          =    0;     // endTransmission() results.
+const uint8_t WIRE_NACK_ADDRESS =    2;
+
+
+/** A simulated I2C bus.
+ */
+class TwoWire
+{
+    private:
+
+    uint8_t deviceIds[WIRE_DEVICE_MAX];         // Each device's I2C ID.
+    uint8_t deviceSegments[WIRE_DEVICE_MAX];    // Each device's segment, or WIRE_MAIN_BUS.
+    uint8_t devices = 0;
+
+    uint8_t target  = 0;                        // ID of the current transmission.
+    uint8_t txBuffer[BUFFER_LENGTH];
+    uint8_t txLen   = 0;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    uint8_t rxLen   = 0;
+    uint8_t rxNext  = 0;
+
+
+    /** Find the devices answering at an ID.
+     *  Return how many answered, and note the segment of the last one.
+     */
+    uint8_t answer(uint8_t aId)
+    {
+        uint8_t count = 0;
+
+        for (uint8_t device = 0; device < devices; device++)
+        {
+            uint8_t segment = deviceSegments[device];
+
+            if (   (deviceIds[device] == aId)
+                && (   (segment == WIRE_MAIN_BUS)
+                    || (muxChannels[segment >> WIRE_MUX_SHIFT] & (1 << (segment & WIRE_MUX_CHANNELS)))))
+            {
+                count      += 1;
+                lastSegment = segment;
+            }
+        }
+
+        if (count > 1)
+        {
+            collisions += 1;
+        }
+
+        return count;
+    }
+
+
+    /** Is the ID one of the multiplexers?
+     */
+    bool isMux(uint8_t aId)
+    {
+        return    (aId >= WIRE_MUX_BASE_ID)
+               && (aId <  WIRE_MUX_BASE_ID + muxCount);
+    }
+
+
+    public:
+
+    uint8_t  muxCount = 0;                      // Multiplexers fitted.
+    uint8_t  muxChannels[WIRE_MUX_MAX];         // Each multiplexer's connected channels.
+    bool     muxFailed[WIRE_MUX_MAX];           // Multiplexers that don't answer.
+    uint16_t muxWrites  = 0;                    // Channel selections written to the multiplexers.
+    uint16_t transfers  = 0;                    // Transfers that reached a device (other than a multiplexer).
+    uint16_t collisions = 0;                    // Transfers answered by more than one device.
+    uint8_t  lastId      = 0;                   // ID of the latest transfer to reach a device.
+    uint8_t  lastSegment = WIRE_MAIN_BUS;       // Segment of the device it reached.
+
+
+    /** Add a device on a segment (or the main bus).
+     */
+    void addDevice(uint8_t aId, uint8_t aSegment)
+    {
+        if (devices < WIRE_DEVICE_MAX)
+        {
+            deviceIds[devices]      = aId;
+            deviceSegments[devices] = aSegment;
+            devices += 1;
+        }
+    }
+
+
+    void begin(uint8_t aId)                         { }
+    void end()                                      { }
+    void setClock(long aSpeed)                      { }
+    void setWireTimeout(uint32_t aMicros, bool aReset) { }
+    bool getWireTimeoutFlag()                       { return false; }
+    void clearWireTimeoutFlag()                     { }
+    void onReceive(void (*aHandler)(int))           { }
+    void onRequest(void (*aHandler)(void))          { }
+
+
+    void beginTransmission(uint8_t aId)
+    {
+        target = aId;
+        txLen  = 0;
+    }
+
+
+    size_t write(uint8_t aByte)
+    {
+        if (txLen >= BUFFER_LENGTH)
+        {
+            return 0;
+        }
+
+        txBuffer[txLen++] = aByte;
+        return 1;
+    }
+
+
+    size_t write(const uint8_t* aBuffer, uint8_t aLength)
+    {
+        size_t written = 0;
+
+        while (   (written < aLength)
+               && (write(aBuffer[written]) == 1))
+        {
+            written += 1;
+        }
+
+        return written;
+    }
+
+
+    /** Deliver the transmission.
+     *  A multiplexer takes the first byte as its connected channels.
+     */
+    uint8_t endTransmission()
+    {
+        if (isMux(target))
+        {
+            uint8_t mux = target - WIRE_MUX_BASE_ID;
+
+            if (muxFailed[mux])
+            {
+                return WIRE_NACK_ADDRESS;
+            }
+
+            if (txLen > 0)
+            {
+                muxChannels[mux] = txBuffer[0];
+                muxWrites       += 1;
+            }
+
+            return WIRE_ACK;
+        }
+
+        if (answer(target) == 0)
+        {
+            return WIRE_NACK_ADDRESS;
+        }
+
+        transfers += 1;
+        lastId     = target;
+        return WIRE_ACK;
+    }
+
+
+    /** Request bytes from a device.
+     *  The device answers with its ID, so the reader can tell who answered.
+     */
+    uint8_t requestFrom(uint8_t aId, uint8_t aLength)
+    {
+        rxLen  = 0;
+        rxNext = 0;
+
+        if (answer(aId) > 0)
+        {
+            transfers += 1;
+            lastId     = aId;
+
+            while (   (rxLen < aLength)
+                   && (rxLen < BUFFER_LENGTH))
+            {
+                rxBuffer[rxLen++] = aId;
+            }
+        }
+
+        return rxLen;
+    }
+
+
+    int available()
+    {
+        return rxLen - rxNext;
+    }
+
+
+    int read()
+    {
+        return (rxNext < rxLen) ? rxBuffer[rxNext++] : -1;
+    }
+};
+
+
+TwoWire Wire;
+
+
+#endif
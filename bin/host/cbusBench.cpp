@@ -0,0 +1,143 @@
+/** Benchmark the Gateway's CBUS event layer (see Gateway/Cbus.h) on Linux, over LoopbackCan.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Build and run from the repository's top directory:
+ *      g++ -O2 -o /tmp/cbusBench bin/host/cbusBench.cpp && /tmp/cbusBench [rounds]
+ *
+ *  Each round produces an event for every Output pin, as the Gateway's 'b' command, and sends them all.
+ *  The loopback receives each frame back, so every event is also looked up in the learned events,
+ *  CBUS_EVENTS_MAX of which are learned first. Reports events/sec for the whole run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Host.h"
+
+
+// As Gateway.h.
+#define CBUS_MCP2515       false
+#define CBUS_NODE_NUMBER     256
+#define CBUS_CAN_ID           99
+#define CBUS_QUEUE_MAX        32
+#define CBUS_QUEUE_ON     0x8000
+#define CBUS_EVENTS_MAX       32
+#define CBUS_LOOPBACK_FRAMES   8
+
+#define NODES_WIDE         false
+#define OUTPUT_NODE_MAX       32
+#define OUTPUT_PIN_MAX         8
+
+
+// As I2cComms.h.
+const uint8_t COMMS_COMMAND_MASK    = 0xf0;
+const uint8_t COMMS_OPTION_MASK     = 0x0f;
+const uint8_t COMMS_CMD_SET_LO      = 0x20;
+const uint8_t COMMS_CMD_SET_HI      = 0x30;
+const uint8_t COMMS_CMD_INP_LO      = 0x90;
+const uint8_t COMMS_CMD_INP_HI      = 0xA0;
+
+
+#include "../../Gateway/Cbus.h"
+
+
+const long BENCH_ROUNDS = 1000;             // Default rounds.
+
+LoopbackCan   canTransport;
+Cbus          cbus(canTransport, CBUS_NODE_NUMBER, CBUS_CAN_ID);
+unsigned long consumed = 0;                 // Events the handler was given.
+
+
+/** Handler for consumed events.
+ */
+void consumeEvent(uint8_t aCommand, uint8_t aNode)
+{
+    consumed += 1;
+}
+
+
+/** Send a frame through the loopback and have the Cbus layer receive it.
+ */
+void sendFrame(uint8_t aLen, uint8_t aOpcode, uint16_t aNodeNumber, uint16_t aEventNumber = 0, uint8_t aIndex = 0, uint8_t aValue = 0)
+{
+    CanFrame frame;
+
+    frame.id      = CBUS_PRIORITY | 1;
+    frame.len     = aLen;
+    frame.data[0] = aOpcode;
+    frame.data[1] = highByte(aNodeNumber);
+    frame.data[2] = lowByte(aNodeNumber);
+    frame.data[3] = highByte(aEventNumber);
+    frame.data[4] = lowByte(aEventNumber);
+    frame.data[5] = aIndex;
+    frame.data[6] = aValue;
+
+    canTransport.send(frame);
+    cbus.update();
+}
+
+
+/** Learn our own events for pin 0 of the first CBUS_EVENTS_MAX Output nodes, so they're consumed as they come back.
+ */
+void learnEvents()
+{
+    sendFrame(3, CBUS_OPC_NNLRN, CBUS_NODE_NUMBER);
+
+    for (uint8_t node = 0; node < CBUS_EVENTS_MAX; node++)
+    {
+        sendFrame(7, CBUS_OPC_EVLRN, CBUS_NODE_NUMBER, CBUS_EVENT_OUTPUT + (node << 3), 1, COMMS_CMD_SET_HI);
+        sendFrame(7, CBUS_OPC_EVLRN, CBUS_NODE_NUMBER, CBUS_EVENT_OUTPUT + (node << 3), 2, node);
+    }
+
+    sendFrame(3, CBUS_OPC_NNULN, CBUS_NODE_NUMBER);
+}
+
+
+int main(int argc, char** argv)
+{
+    long rounds = (argc > 1) ? atol(argv[1]) : BENCH_ROUNDS;
+
+    cbus.onConsume(consumeEvent);
+    cbus.begin();
+    learnEvents();
+
+    uint32_t      sent   = cbus.getFramesSent();
+    unsigned long start  = micros();
+
+    for (long round = 0; round < rounds; round++)
+    {
+        for (uint8_t node = 0; node < OUTPUT_NODE_MAX; node++)
+        {
+            for (uint8_t pin = 0; pin < OUTPUT_PIN_MAX; pin++)
+            {
+                while (!cbus.produce(true, node, pin, (node + pin + round) & 1))
+                {
+                    cbus.update();                  // Queue full, send some.
+                }
+            }
+        }
+    }
+
+    while (cbus.getFramesSent() - sent < (uint32_t)(rounds * OUTPUT_NODE_MAX * OUTPUT_PIN_MAX))
+    {
+        cbus.update();
+    }
+    cbus.update();                                  // Receive the last frames.
+
+    unsigned long elapsed = micros() - start;
+    unsigned long events  = cbus.getFramesSent() - sent;
+
+    printf("CBUS events=%lu, usecs=%lu, events/sec=%.0f\n", events, elapsed, events * 1e6 / (elapsed ? elapsed : 1));
+    printf("received=%u, merged=%u, consumed=%lu\n", cbus.getFramesReceived(), cbus.getEventsMerged(), consumed);
+
+    return (consumed == (unsigned long)rounds * CBUS_EVENTS_MAX) ? 0 : 1;
+}
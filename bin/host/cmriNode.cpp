@@ -0,0 +1,223 @@
+/** Run the SignalBox's CMRI handler (see SignalBox/Cmri.h) on Linux, answering on a pty.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  "bin/cmriBench node" builds and runs this, or build it from the repository's top directory:
+ *      g++ -O2 -o /tmp/cmriNode bin/host/cmriNode.cpp && /tmp/cmriNode
+ *  It prints the pty to give to "cmriBench run".
+ *
+ *  The Controller and OutputCtl are stand-ins holding the Input and Output states. Actioning an Input toggles it,
+ *  and setting an Output changes its state, so TRANSMITs show up in the following polls.
+ *  Characters that can't start a CMRI message are discarded, as the Command handler would take them.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "Host.h"
+
+
+// As SignalBox's Config.h, SystemMgr.h, InputDef.h (large EEPROM) and OutputDef.h.
+const unsigned long CMRI_BUDGET     = 2000L;
+const uint8_t       CHAR_STX        = 0x02;
+const uint8_t       CHAR_ETX        = 0x03;
+const uint8_t       CHAR_DLE        = 0x10;
+const uint8_t       CHAR_SYN        = 0xff;
+const uint8_t       INPUT_NODE_MAX  =   16;
+const uint8_t       OUTPUT_NODE_MAX =   32;
+
+const int           NODE_POLL_MSECS =   10;     // Time to wait for characters before looking again.
+
+uint16_t            stateChanges = 0;           // As OutputCtl.h.
+
+
+/** Stands in for OutputCtl, holding the Output states.
+ */
+class OutputCtl
+{
+    public:
+
+    uint8_t states[OUTPUT_NODE_MAX];
+
+    uint8_t getOutputStates(uint8_t aNode)
+    {
+        return states[aNode];
+    }
+
+    bool getOutputState(uint8_t aNode, uint8_t aPin)
+    {
+        return (states[aNode] & (1 << aPin)) != 0;
+    }
+};
+
+
+/** Stands in for the Controller, holding the Input states and setting Outputs.
+ */
+class Controller
+{
+    public:
+
+    uint16_t inputStates[INPUT_NODE_MAX];
+
+    uint16_t getInputState(uint8_t aInputNode)
+    {
+        return inputStates[aInputNode];
+    }
+
+    void processInput(uint8_t aNode, uint8_t aPin, bool aState);
+    void processOutput(uint8_t aNode, uint8_t aPin, bool aState, uint8_t aDelay);
+};
+
+
+OutputCtl  outputCtl;
+Controller controller;
+
+
+void Controller::processInput(uint8_t aNode, uint8_t aPin, bool aState)
+{
+    inputStates[aNode] ^= 1 << aPin;
+    stateChanges       += 1;
+}
+
+
+void Controller::processOutput(uint8_t aNode, uint8_t aPin, bool aState, uint8_t aDelay)
+{
+    if (aState)
+    {
+        outputCtl.states[aNode] |= 1 << aPin;
+    }
+    else
+    {
+        outputCtl.states[aNode] &= ~(1 << aPin);
+    }
+    stateChanges += 1;
+}
+
+
+/** A Stream on the master side of a pty.
+ */
+class PtyStream: public Stream
+{
+    private:
+
+    int     fd;
+    uint8_t buffer[256];                        // Characters read and not yet consumed.
+    int     head  = 0;
+    int     count = 0;
+
+
+    public:
+
+    PtyStream(int aFd):
+        fd(aFd)
+    {
+    }
+
+
+    /** Wait (up to the given time) for characters to arrive, if there are none buffered.
+     */
+    void wait(int aMsecs)
+    {
+        struct pollfd ready = { fd, POLLIN, 0 };
+        if (count == 0)
+        {
+            poll(&ready, 1, aMsecs);
+        }
+    }
+
+
+    int available()
+    {
+        if (count == 0)
+        {
+            int len = ::read(fd, buffer, sizeof(buffer));
+            head  = 0;
+            count = (len > 0) ? len : 0;
+        }
+        return count;
+    }
+
+
+    int peek()
+    {
+        return (available() > 0) ? buffer[head] : -1;
+    }
+
+
+    int read()
+    {
+        if (available() == 0)
+        {
+            return -1;
+        }
+        count -= 1;
+        return buffer[head++];
+    }
+
+
+    size_t write(uint8_t aByte)
+    {
+        return write(&aByte, 1);
+    }
+
+
+    size_t write(const uint8_t* aBuffer, size_t aLength)
+    {
+        return ::write(fd, aBuffer, aLength) == (ssize_t)aLength ? aLength : 0;
+    }
+};
+
+
+#include "../../SignalBox/Cmri.h"
+
+
+int main()
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (   (master < 0)
+        || (grantpt(master) != 0)
+        || (unlockpt(master) != 0))
+    {
+        perror("pty");
+        return 1;
+    }
+
+    struct termios attrs;
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);   // Held open so the master doesn't see a hangup between runs.
+    tcgetattr(master, &attrs);
+    cfmakeraw(&attrs);
+    tcsetattr(master, TCSANOW, &attrs);
+    tcsetattr(slave,  TCSANOW, &attrs);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    printf("CMRI node (Cmri.h) on %s\n", ptsname(master));
+    fflush(stdout);
+
+    PtyStream stream(master);
+    Cmri      cmri(stream);
+
+    while (true)
+    {
+        stream.wait(NODE_POLL_MSECS);
+        cmri.update();
+
+        if (   (cmri.isIdle())
+            && (stream.available() > 0)
+            && (stream.peek() != CHAR_SYN))
+        {
+            stream.read();                      // Not CMRI, the Command handler's.
+        }
+    }
+}
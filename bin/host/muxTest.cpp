@@ -0,0 +1,144 @@
+/** Test the SignalBox's multiplexer segment handling (see SignalBox/I2cComms.h) on Linux, over a simulated bus.
+ *  @file
+ *
+ *  (c)Copyright Tony Clulow  2021  tony.clulow@pentadtech.com
+ *
+ *  This work is licensed under the:
+ *      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+ *      http://creativecommons.org/licenses/by-nc-sa/4.0/
+ *
+ *  For commercial use, please contact the original copyright holder(s) to agree licensing terms.
+ *
+ *
+ *  Build and run from the repository's top directory:
+ *      g++ -O2 -Ibin/host -o /tmp/muxTest bin/host/muxTest.cpp && /tmp/muxTest
+ *
+ *  Two TCA9548As (16 segments) on the simulated bus of Wire.h, with Input nodes and Output modules
+ *  on some of their segments, and the LCD on the main bus.
+ *  Checks that looking up IDs doesn't touch the multiplexers, that each transfer selects its node's segment
+ *  (only when it isn't already selected), and that a failed selection fails the transfer.
+ *  Prints each check, and exits non-zero if any failed.
+ */
+
+#include <stdio.h>
+
+#include "Host.h"
+
+
+// As SignalBox's Config.h, with two multiplexers.
+#define COMMS_RS485 false
+#define NODES_WIDE  false
+
+const uint8_t  I2C_CONTROLLER_ID   = 0x10;
+const uint8_t  I2C_GATEWAY_ID      = 0x11;
+const uint8_t  I2C_INPUT_BASE_ID   = 0x20;
+const uint8_t  I2C_OUTPUT_BASE_ID  = 0x50;
+const uint8_t  I2C_ENUM_ID         = 0x4f;
+const uint8_t  I2C_OUTPUT_ID_MASK  = 0xff;
+const uint8_t  I2C_MUX_BASE_ID     = 0x70;
+const uint8_t  I2C_MUX_MAX         = 2;
+const uint8_t  I2C_LCD_ID          = 0x27;      // As found by SignalBox.ino's LCD scan.
+const uint32_t I2C_TIMEOUT         = 25000L;
+const long     I2C_SPEED           = 0;
+
+
+#include "../../SignalBox/I2cComms.h"
+
+
+int failures = 0;
+
+
+/** Report a check.
+ */
+void check(bool aPassed, const char* aCheck)
+{
+    printf("%s  %s\n", aPassed ? "pass" : "FAIL", aCheck);
+    failures += aPassed ? 0 : 1;
+}
+
+
+int main()
+{
+    Wire.muxCount = I2C_MUX_MAX;
+    Wire.addDevice(I2C_LCD_ID,             WIRE_MAIN_BUS);
+    Wire.addDevice(I2C_GATEWAY_ID,         WIRE_MAIN_BUS);
+    Wire.addDevice(I2C_INPUT_BASE_ID + 0,  2);          // Input node 16.
+    Wire.addDevice(I2C_INPUT_BASE_ID + 3,  2);          // Input node 19.
+    Wire.addDevice(I2C_INPUT_BASE_ID + 7,  0);          // Input node 7, at the LCD's address.
+    Wire.addDevice(I2C_INPUT_BASE_ID + 2,  9);          // Input node 74, on the second multiplexer.
+    Wire.addDevice(I2C_OUTPUT_BASE_ID + 9, 1);          // Output node 9.
+    Wire.addDevice(I2C_ENUM_ID,            1);          // An unassigned Output module.
+
+    i2cComms.setId(I2C_CONTROLLER_ID);
+    i2cComms.resetSegments();
+    uint16_t writes = Wire.muxWrites;
+
+    i2cComms.inputId(19);
+    i2cComms.inputId(74);
+    i2cComms.outputId(9);
+    i2cComms.enumId(9);
+    check(   (Wire.muxWrites == writes)
+          && (Wire.muxChannels[0] == 0)
+          && (Wire.muxChannels[1] == 0),                "Looking up IDs leaves the multiplexers alone");
+
+    check(   (i2cComms.sendShort(i2cComms.inputId(19), 0) == 0)
+          && (Wire.lastSegment == 2)
+          && (Wire.lastId == I2C_INPUT_BASE_ID + 3)
+          && (Wire.muxChannels[0] == 0x04),             "Transfer selects the Input's segment");
+
+    writes = Wire.muxWrites;
+    check(   (i2cComms.requestPacket(i2cComms.inputId(16), 2))
+          && (i2cComms.readByte() == I2C_INPUT_BASE_ID)
+          && (Wire.lastSegment == 2)
+          && (Wire.muxWrites == writes),                "Same segment isn't selected again");
+
+    check(   (i2cComms.sendShort(I2C_GATEWAY_ID, 0) == 0)
+          && (Wire.lastSegment == WIRE_MAIN_BUS)
+          && (Wire.muxWrites == writes),                "Main bus transfer leaves the segment selected");
+
+    check(   (i2cComms.sendShort(i2cComms.outputId(9), 0) == 0)
+          && (Wire.lastSegment == 1)
+          && (Wire.muxChannels[0] == 0x02),             "Transfer selects the Output's segment");
+
+    check(   (i2cComms.exists(i2cComms.enumId(9)))
+          && (Wire.lastSegment == 1)
+          && (!i2cComms.exists(i2cComms.enumId(17))),   "Enumeration ID is on the node's segment");
+
+    check(   (i2cComms.requestByte(i2cComms.inputId(74)) == I2C_INPUT_BASE_ID + 2)
+          && (Wire.lastSegment == 9)
+          && (Wire.muxChannels[0] == 0)
+          && (Wire.muxChannels[1] == 0x02),             "Segment on another multiplexer disconnects the first");
+
+    writes = Wire.muxWrites;
+    i2cComms.recoverBus();
+    check(   (i2cComms.exists(i2cComms.inputId(74)))
+          && (Wire.muxWrites > writes)
+          && (Wire.muxChannels[1] == 0x02),             "Segment is selected again after a bus recovery");
+
+    uint16_t collisions = Wire.collisions;
+    i2cComms.exists(i2cComms.inputId(7));
+    check(   (lowByte(i2cComms.inputId(7)) == I2C_LCD_ID)
+          && (Wire.collisions == collisions + 1),       "Input at the LCD's address collides with it");
+
+    uint16_t transfers = Wire.transfers;
+    Wire.muxFailed[1]  = true;
+    check(   (i2cComms.sendShort(i2cComms.inputId(74), 0) == I2C_ERROR_SEGMENT)
+          && (i2cComms.sendData(i2cComms.inputId(74), 0, 1, 2) == I2C_ERROR_SEGMENT)
+          && (!i2cComms.requestPacket(i2cComms.inputId(74), 2))
+          && (i2cComms.requestByte(i2cComms.inputId(74)) < 0)
+          && (!i2cComms.exists(i2cComms.inputId(74)))
+          && (Wire.transfers == transfers),             "Failed selection fails the transfer");
+
+    check(   (i2cComms.sendShort(i2cComms.inputId(19), 0) == 0)
+          && (Wire.lastSegment == 2),                   "Working segment still reachable after a failed selection");
+
+    Wire.muxFailed[1] = false;
+    check(   (i2cComms.sendShort(i2cComms.inputId(74), 0) == 0)
+          && (Wire.lastSegment == 9),                   "Failed selection is tried again");
+
+    check(   (i2cComms.sendShort(i2cComms.inputId(I2C_MUX_MAX << (I2C_MUX_SHIFT + I2C_SEGMENT_SHIFT)), 0) == I2C_ERROR_SEGMENT)
+          && (Wire.muxChannels[0] == 0)
+          && (Wire.muxChannels[1] == 0),                "Segment beyond the multiplexers fails");
+
+    return (failures == 0) ? 0 : 1;
+}